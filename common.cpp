@@ -2,7 +2,7 @@
 #include <stdlib.h>
 
 /* safer malloc */
-void *my_malloc(int i) {
+void *my_malloc(size_t i) {
 	void *mem;
 	
 	mem = (void*)malloc(i);
@@ -15,11 +15,15 @@ void *my_malloc(int i) {
 }
 
 /* safer realloc */
-void *my_realloc(void *memblk, int i) {
+void *my_realloc(void *memblk, size_t i) {
 	void *mem;
-	printf("Doing realloc %d %p\n", i, memblk);
+#ifndef NO_GRAPHICS
+	printf("Doing realloc %zu %p\n", i, memblk);
+#endif
 	mem = (void*)realloc(memblk, i);
+#ifndef NO_GRAPHICS
     printf("Done realloc\n");
+#endif
 	if (mem == NULL) {
 		printf("memory allocation failed!");
 		exit(-1);
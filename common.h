@@ -1,3 +1,5 @@
-void *my_malloc(int i);
-void *my_realloc(void *memblk, int i);
+#include <stddef.h>
+
+void *my_malloc(size_t i);
+void *my_realloc(void *memblk, size_t i);
 
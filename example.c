@@ -1,6 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "graphics.h"
 #include "common.h"
 
@@ -15,8 +21,24 @@ void proceed_fast_button_func(void (*drawscreen_ptr) (void));
 void mouse_move (float x, float y);
 void key_press (int i);
 void init_grid();
+void wire_index_init();
+void wire_index_clear();
+void reset_grid();
+char *parse_args(int argc, char *argv[]);
 int parse_file(char *file);
+int write_binary(char *file);
+int solution_open(char *file, long length);
+int checkpoint_read(char *file, long *solution_length);
+void solution_close();
+bool is_valid_coordinates(int col, int row);
 void run_lee_moore_algo();
+bool reached_sink(int col, int row);
+int get_label(int col, int row);
+void set_label(int col, int row, int value);
+int get_sink_value(int col, int row);
+bool is_labelled(int col, int row);
+int bitboard_get_label(int col, int row);
+bool bitboard_has_label(int col, int row, int value);
 
 bool done = false;
 int num_rows = 0;
@@ -25,26 +47,256 @@ int num_sources = 0;
 int num_sinks = 0;
 int num_successful_sinks = 0;
 int num_failed_sinks = 0;
+long long num_expanded_cells = 0;
+
+// Bits of GRID::flags
+#define CELL_OBSTRUCTION 0x01   // this cell is an obstruction for wiring
+#define CELL_SOURCE 0x02        // it's a source
+#define CELL_SINK 0x04          // it's a sink
+#define CELL_ROUTED 0x08        // we've tried routing this net
+#define CELL_WIRE 0x10          // the cell is a wire
+#define CELL_FAILED_SOURCE 0x20 // a source the current sink could not be reached from
+#define CELL_PIN (CELL_SOURCE | CELL_SINK)
+
+// Index of a cell in the order of the layout (see cell_id). The sparse
+// layout can span more cells than an int can count, so it is 64 bits.
+typedef long long CELL_ID;
+
+// Routing state of the grid as one dense array per field, indexed by cell id.
+// Render geometry is not stored; draw_grid works it out from the cell size.
+typedef struct GRID {
+    unsigned char *flags;   // CELL_* bits
+    int *wire_num;          // wire number (i.e. the net number)
+    int *value;             // value of the lee-moore algo
+    int *sink_value;        // value of the wave grown from the sink (bidirectional engine)
+    int *epoch;             // search the two values belong to; stale if not cur_epoch
+    unsigned char *label_plane; // compact labels, 4 cells per byte (NULL unless -l mod3)
+    unsigned char *pred_plane;  // 2-bit DIRECTION of each cell's predecessor
+} GRID;
+
+GRID grid = {};
+long long num_cells = 0;
+void alloc_grid_arrays(GRID *g, int num);
+void free_grid_arrays(GRID *g);
+
+// Order the cells are stored in. Everything indexed by cell id (the grid
+// arrays, the label and predecessor bitplanes, the BFS queues) follows it.
+typedef enum LAYOUT {
+    LAYOUT_COLUMN,  // one column after another, so only vertical neighbors are adjacent
+    LAYOUT_TILED,   // TILE_SIZE x TILE_SIZE tiles, row by row inside a tile, so
+                    // the four neighbors of most cells are in the same few cache lines
+    LAYOUT_SPARSE   // tiled in CHUNK_SIZE x CHUNK_SIZE chunks that are only
+                    // allocated once a cell in them is written
+} LAYOUT;
+
+LAYOUT layout = LAYOUT_COLUMN;
+
+#define TILE_SHIFT 3
+#define CHUNK_SHIFT 5
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+#define CHUNK_CELLS (CHUNK_SIZE * CHUNK_SIZE)
+int tile_shift = 0;     // log2 of the tile size of the tiled and sparse layouts
+int tile_rows = 0;      // tiles in a column of the grid
+
+// Chunks of the sparse layout, one per tile. A missing chunk reads as a
+// stretch of untouched cells. The dense layouts have a single chunk, grid.
+GRID **chunks = NULL;
+int num_chunks = 0;
+int chunk_cells = 0;    // cells per chunk
+int num_allocated_chunks = 0;
+
+CELL_ID cell_id(int col, int row) {
+    if (layout != LAYOUT_COLUMN) {
+        int mask = (1 << tile_shift) - 1;
+        CELL_ID tile = (CELL_ID)(col >> tile_shift) * tile_rows + (row >> tile_shift);
+        return (tile << (2 * tile_shift)) | ((row & mask) << tile_shift) | (col & mask);
+    }
+    return (CELL_ID)col * num_rows + row;
+}
+
+int cell_col(CELL_ID id) {
+    if (layout != LAYOUT_COLUMN) {
+        int mask = (1 << tile_shift) - 1;
+        CELL_ID tile = id >> (2 * tile_shift);
+        return (int)(((tile / tile_rows) << tile_shift) | (id & mask));
+    }
+    return (int)(id / num_rows);
+}
+
+int cell_row(CELL_ID id) {
+    if (layout != LAYOUT_COLUMN) {
+        int mask = (1 << tile_shift) - 1;
+        CELL_ID tile = id >> (2 * tile_shift);
+        return (int)(((tile % tile_rows) << tile_shift) | ((id >> tile_shift) & mask));
+    }
+    return (int)(id % num_rows);
+}
+
+/**
+ * Find the arrays holding cell id and turn id into an index into them.
+ * Returns NULL for a cell of the sparse grid whose chunk was never written.
+ */
+GRID *find_chunk(CELL_ID *id) {
+    if (layout != LAYOUT_SPARSE) {
+        return &grid;
+    }
+    GRID *chunk = chunks[*id >> (2 * CHUNK_SHIFT)];
+    *id &= CHUNK_CELLS - 1;
+    return chunk;
+}
+
+/**
+ * As find_chunk, but allocate the chunk if it is missing, for writing.
+ */
+GRID *make_chunk(CELL_ID *id) {
+    if (layout != LAYOUT_SPARSE) {
+        return &grid;
+    }
+    GRID **chunk = &chunks[*id >> (2 * CHUNK_SHIFT)];
+    if (*chunk == NULL) {
+        *chunk = (GRID *)my_malloc(sizeof(GRID));
+        alloc_grid_arrays(*chunk, CHUNK_CELLS);
+        num_allocated_chunks++;
+    }
+    *id &= CHUNK_CELLS - 1;
+    return *chunk;
+}
+
+unsigned char get_flags(CELL_ID id) {
+    GRID *g = find_chunk(&id);
+    return (g != NULL) ? g->flags[id] : 0;
+}
+
+int get_wire_num(CELL_ID id) {
+    GRID *g = find_chunk(&id);
+    return (g != NULL) ? g->wire_num[id] : -1;
+}
+
+void set_wire_num(CELL_ID id, int wire_num) {
+    GRID *g = make_chunk(&id);
+    g->wire_num[id] = wire_num;
+}
+
+float cell_width = 0.;
+float cell_height = 0.;
+
+// Whole-grid occupancy bitplanes, kept in step with the flags by set_flag and
+// clear_flag. Bit (col % 64) of word (col / 64) in a row stands for
+// (col, row), so a word covers 64 horizontally adjacent cells and can be
+// tested or combined in one operation.
+#define WORD_BITS 64
+typedef unsigned long long WORD;
+
+int words_per_row = 0;
+WORD *obstruction_plane = NULL;
+WORD *wire_plane = NULL;
+WORD *pin_plane = NULL;     // sources and sinks
+
+/**
+ * See if cell id has any of the given CELL_* bits set.
+ */
+bool has_flag(CELL_ID id, unsigned char flag) {
+    return (get_flags(id) & flag) != 0;
+}
+
+/**
+ * Pick the occupancy bitplane that mirrors a flag, if there is one.
+ */
+WORD *flag_plane(unsigned char flag) {
+    switch (flag) {
+        case CELL_OBSTRUCTION: return obstruction_plane;
+        case CELL_WIRE: return wire_plane;
+        case CELL_SOURCE: return pin_plane;
+        case CELL_SINK: return pin_plane;
+        default: return NULL;
+    }
+}
+
+void set_flag(CELL_ID id, unsigned char flag) {
+    CELL_ID index = id;
+    GRID *g = make_chunk(&index);
+    g->flags[index] |= flag;
+    WORD *plane = flag_plane(flag);
+    if (plane != NULL) {
+        int col = cell_col(id);
+        plane[cell_row(id) * words_per_row + col / WORD_BITS] |= (WORD)1 << (col % WORD_BITS);
+    }
+}
+
+void clear_flag(CELL_ID id, unsigned char flag) {
+    CELL_ID index = id;
+    GRID *g = find_chunk(&index);
+    if (g == NULL) {
+        return;
+    }
+    g->flags[index] &= ~flag;
+    WORD *plane = flag_plane(flag);
+    // A cell that is still a source or sink keeps its bit in pin_plane
+    if (plane != NULL && !((flag & CELL_PIN) && has_flag(id, CELL_PIN))) {
+        int col = cell_col(id);
+        plane[cell_row(id) * words_per_row + col / WORD_BITS] &= ~((WORD)1 << (col % WORD_BITS));
+    }
+}
+
+/**
+ * Set bits col1..col2 of one row of a bitplane, a whole word at a time.
+ */
+void fill_plane_row(WORD *row_words, int col1, int col2) {
+    int first = col1 / WORD_BITS;
+    int last = col2 / WORD_BITS;
+    WORD first_mask = ~(WORD)0 << (col1 % WORD_BITS);
+    WORD last_mask = ~(WORD)0 >> (WORD_BITS - 1 - col2 % WORD_BITS);
+    if (first == last) {
+        row_words[first] |= first_mask & last_mask;
+        return;
+    }
+    row_words[first] |= first_mask;
+    for (int w = first + 1; w < last; w++) {
+        row_words[w] = ~(WORD)0;
+    }
+    row_words[last] |= last_mask;
+}
+
+/**
+ * As set_flag for every cell of the rectangle (col1, row1)-(col2, row2),
+ * corners included. Cells that are adjacent in memory are filled in one
+ * loop: a stretch of a column in the column layout, a stretch of a tile
+ * row in the tiled and sparse ones.
+ */
+void fill_flag(int col1, int row1, int col2, int row2, unsigned char flag) {
+    if (layout == LAYOUT_COLUMN) {
+        for (int col = col1; col <= col2; col++) {
+            unsigned char *flags = &grid.flags[cell_id(col, row1)];
+            for (int i = 0; i <= row2 - row1; i++) {
+                flags[i] |= flag;
+            }
+        }
+    } else {
+        int mask = (1 << tile_shift) - 1;
+        for (int col = col1; col <= col2; col = (col | mask) + 1) {
+            int last_col = ((col | mask) < col2) ? (col | mask) : col2;
+            for (int row = row1; row <= row2; row++) {
+                CELL_ID id = cell_id(col, row);
+                GRID *g = make_chunk(&id);
+                unsigned char *flags = &g->flags[id];
+                for (int i = 0; i <= last_col - col; i++) {
+                    flags[i] |= flag;
+                }
+            }
+        }
+    }
+
+    WORD *plane = flag_plane(flag);
+    if (plane != NULL) {
+        for (int row = row1; row <= row2; row++) {
+            fill_plane_row(&plane[row * words_per_row], col1, col2);
+        }
+    }
+}
 
-typedef struct CELL {
-    float x1;       // x-coordinate of the cell's top left corner
-    float y1;       // y-coordinate of the cell's top left corner
-    float x2;       // x-coordinate of the cell's bottom right corner
-    float y2;       // y-coordinate of the cell's bottom right corner
-    char text[5];   // text of the cell
-    float text_x;   // x-coordinate of the text
-    float text_y;   // y-coordinate of the text
-
-    bool is_obstruction;    // true if this cell is an obstruction for wiring
-    bool is_source;         // true if it's a source
-    bool is_sink;           // true if it's a sink
-    bool is_routed;         // true if we've tried routing this net
-    bool is_wire;           // true if the cell is a wire
-    int wire_num;           // wire number (i.e. the net number)
-    int value;              // value of the lee-moore algo
-} CELL;
-
-CELL **grid;
+// Labels of a cell only count when its epoch matches, so starting a new
+// search just bumps cur_epoch instead of sweeping the whole grid
+int cur_epoch = 1;
 
 int cur_src_col = -1;
 int cur_src_row = -1;
@@ -52,7 +304,15 @@ int cur_sink_col = -1;
 int cur_sink_row = -1;
 int cur_trace_col = -1;
 int cur_trace_row = -1;
+int cur_trace_value = -1;   // label of the current trace cell
+int cur_trace_dir = -1;     // direction of the last traceback step
+
+// Cells of the traceback in progress, sink first
+CELL_ID *trace_path = NULL;
+int trace_path_len = 0;
+int max_trace_path_len = 0;
 int cur_wire_num = -1;
+int sink_label = -1;        // label the wave reached the sink with
 
 typedef struct LOCATION {
     int col;
@@ -61,20 +321,211 @@ typedef struct LOCATION {
     LOCATION *next;
     LOCATION *prev;
 } LOCATION;
-void add_to_list(LOCATION **head, LOCATION * g);
-LOCATION *pop_from_list(LOCATION **head);
-void remove_from_list(LOCATION **head, LOCATION *remove);
-LOCATION *make_location(int col, int row);
+
+// List of LOCATIONs that also keeps its tail, so appending is O(1)
+typedef struct LOCATION_LIST {
+    LOCATION *head;
+    LOCATION *tail;
+    int size;
+} LOCATION_LIST;
+void add_to_list(LOCATION_LIST *list, LOCATION *g);
+LOCATION *pop_from_list(LOCATION_LIST *list);
+
+// Bump allocator for LOCATIONs. Nodes are handed out from blocks of
+// ARENA_BLOCK_SIZE and never freed one by one; arena_reset takes them all back
+// at once and keeps the blocks for reuse.
+#define ARENA_BLOCK_SIZE 1024
+
+typedef struct ARENA_BLOCK {
+    LOCATION nodes[ARENA_BLOCK_SIZE];
+    ARENA_BLOCK *next;
+} ARENA_BLOCK;
+
+typedef struct ARENA {
+    ARENA_BLOCK *first;
+    ARENA_BLOCK *cur;       // block nodes are being handed out from
+    int used;               // nodes of cur handed out
+    int num_blocks;         // blocks allocated
+    long num_allocs;        // nodes handed out over the whole run
+} ARENA;
+LOCATION *arena_alloc(ARENA *a);
+void arena_reset(ARENA *a);
+void arena_free(ARENA *a);
+
+ARENA location_arena = {};  // wavefront and neighbors; reset whenever the wave is dropped
+ARENA failed_arena = {};    // failed_sources_for_multisink; reset after each connection
+ARENA source_arena = {};    // all_sources, kept for the whole run
+
+LOCATION *make_location(ARENA *arena, int col, int row);
 void find_all_sources();
 
+// Dial-style bucket queue. Lee labels only ever grow by one from the cell
+// being expanded, so a small ring of FIFO buckets indexed by label is enough
+// to get O(1) push and pop-min without searching the whole wavefront.
+#define NUM_BUCKETS 4   // must be larger than the biggest label increment
+
+typedef struct BUCKET_QUEUE {
+    LOCATION **head;
+    LOCATION **tail;
+    int num_buckets;    // must be larger than the spread of keys in the queue
+    int min_key;        // smallest key that can still be in the queue
+    int size;           // number of locations in the queue
+} BUCKET_QUEUE;
+void bucket_queue_init(BUCKET_QUEUE *q, int num_buckets);
+void bucket_queue_push(BUCKET_QUEUE *q, LOCATION *g, int key);
+void bucket_queue_push_front(BUCKET_QUEUE *q, LOCATION *g, int key);
+LOCATION *bucket_queue_pop_min(BUCKET_QUEUE *q);
+void bucket_queue_clear(BUCKET_QUEUE *q);
+
 #define MAX_NUM_RETRIES 25
 
-LOCATION *expansion_list = NULL;
+BUCKET_QUEUE expansion_list = {};
+
+// Ring buffer of cell ids (see cell_id) used by the BFS
+// engine. Every cell is labelled at most once per search, so sizing it to the
+// grid means it can never overflow. On the sparse grid it starts small and
+// doubles when full instead.
+typedef struct RING_BUFFER {
+    CELL_ID *cells;
+    int capacity;
+    int head;       // next cell to pop
+    int tail;       // next free slot
+    int size;       // number of cells in the buffer
+} RING_BUFFER;
+void ring_buffer_init(RING_BUFFER *q, int capacity);
+void ring_buffer_clear(RING_BUFFER *q);
+void ring_buffer_push(RING_BUFFER *q, CELL_ID cell);
+CELL_ID ring_buffer_pop(RING_BUFFER *q);
+
+RING_BUFFER bfs_queue = {};
+RING_BUFFER sink_queue = {};    // wave grown from the sink (bidirectional engine)
+
+// Layer bookkeeping of the BFS engine, so it never has to read a label back
+int bfs_layer = 1;          // label of the cells being popped
+int bfs_layer_left = 0;     // cells of that layer still in bfs_queue
+int bfs_next_layer = 0;     // cells of the next layer pushed so far
+
+// Expansion engines selectable from the command line
+typedef enum ENGINE {
+    ENGINE_BUCKET,  // Lee-Moore wavefront kept in the bucket queue
+    ENGINE_BFS,     // unit-cost breadth-first search over the ring buffer
+    ENGINE_ASTAR,   // goal-directed search ordered by label + distance to sink
+    ENGINE_BIDIRECTIONAL,   // BFS waves from both the source and the sink
+    ENGINE_BITBOARD         // whole layers at a time on row bitsets
+} ENGINE;
+
+ENGINE engine = ENGINE_BUCKET;
+
+// Row bitsets used by the bitboard engine, with the same layout as the
+// occupancy bitplanes of the grid. A whole layer of the wave is advanced with
+// word-wide shift/AND/OR operations. Cells are not labelled one by one;
+// instead the nonzero words of every layer are kept, sorted, and the label of
+// a cell is the layer it is in. The words of the last layer are also all a
+// step needs to look at: the next layer can only be in them or next to them.
+typedef struct LAYER_WORD {
+    int word;           // index into the row bitsets
+    WORD bits;
+} LAYER_WORD;
+
+typedef struct BITBOARD {
+    WORD *free;         // cells the wave may enter
+    WORD *visited;      // cells already labelled
+    WORD *frontier;     // cells labelled in the last layer, zero elsewhere
+    WORD *next;         // layer being built, zero elsewhere
+    int layer;          // label of the cells in frontier
+    int frontier_size;  // number of cells in frontier
+    int epoch;          // search the stored layers belong to
+
+    int num_layers;     // layers stored so far, the seeds being layer 1
+    int max_layers;
+    int *layer_start;   // first entry of each layer, and one past the last
+    LAYER_WORD *entries;
+    int num_entries;
+    int max_entries;
+} BITBOARD;
+
+BITBOARD wave = {};
+
+// Compact labels. Every label of the bucket, BFS and bitboard engines is a
+// BFS distance, so neighboring labels differ by at most one and the label
+// mod 3 is enough to find the predecessor during traceback. The labels are
+// kept 2 bits per cell in GRID::label_plane instead of GRID::value, and the
+// value, sink_value and epoch arrays are not allocated at all. Since there
+// are no epochs, a reset clears the label plane instead, but only the blocks
+// of LABEL_BLOCK_CELLS cells a label was written to. A bit per block says
+// whether it is on the list of blocks to clear already.
+#define NO_LABEL 3
+#define LABEL_BLOCK_SHIFT 8
+#define LABEL_BLOCK_CELLS (1 << LABEL_BLOCK_SHIFT)
+
+bool compact_labels = false;
+unsigned char *dirty_blocks = NULL;
+CELL_ID *dirty_list = NULL;     // cell id of the first cell of each dirty block
+long long num_dirty = 0;
+long long max_dirty = 0;
+
+// How traceback finds the next cell towards the source
+typedef enum TRACE {
+    TRACE_SEARCH,   // look for a neighbor labelled one less at every step
+    TRACE_POINTER,  // follow the predecessor direction stored during expansion
+    TRACE_STRAIGHT  // as TRACE_POINTER, but keep going straight whenever the
+                    // cell ahead is labelled one less as well
+} TRACE;
+
+TRACE trace_mode = TRACE_POINTER;
+
+// State of the bidirectional engine. Each wave is expanded one whole layer at
+// a time; the shortest meeting seen while expanding a layer is kept, and the
+// search stops at the end of that layer.
+bool expanding_sink_wave = false;
+int wave_layer = -1;        // label of the layer currently being expanded
+int meet_length = INT_MAX;  // length of the shortest path through a meeting
+int meet_src_col = -1;      // cell of the meeting labelled by the source wave
+int meet_src_row = -1;
+int meet_sink_col = -1;     // cell of the meeting labelled by the sink wave
+int meet_sink_row = -1;
 bool sink_found = false;
 bool multiple_sink = false;
 int num_retries = 0;
-LOCATION *all_sources = NULL;
-LOCATION *failed_sources_for_multisink = NULL;
+bool tree_seeding = true;   // seed every cell already in the net into the wave
+bool multi_target = false;  // expand towards every unrouted sink of the net at once
+CELL_ID *targets = NULL;        // cell ids of the unrouted sinks of the net
+int num_targets = 0;
+
+// Pins and wire cells of each net, indexed by wire number, so looking for
+// the next sink or the cells to start the wave from doesn't scan the grid
+typedef struct NET {
+    CELL_ID *pins;      // cell ids; the source, then the sinks in scan order
+    int num_pins;
+    CELL_ID *cells;     // cell ids of the source and every wire cell laid down
+    int num_cells;
+    int max_cells;
+} NET;
+
+NET *nets = NULL;
+int num_nets = 0;
+
+// Bucketed grid of the wire cells of the net being routed (pins left out),
+// for finding the one closest to a sink without going through the whole net.
+// Each bin covers BIN_SIZE x BIN_SIZE cells and chains the cells in it. It is
+// emptied whenever a new net starts. Only the closest source selection
+// (-s closest) builds it.
+#define BIN_SHIFT 4
+#define BIN_SIZE (1 << BIN_SHIFT)
+
+typedef struct WIRE_INDEX {
+    int *bins;          // first node of each bin (bin_col * bin_rows + bin_row), -1 if empty
+    int bin_columns;
+    int bin_rows;
+    CELL_ID *node_cell; // cell id of each node
+    int *node_next;     // next node in the same bin, -1 at the end
+    int num_nodes;
+    int max_nodes;
+} WIRE_INDEX;
+
+WIRE_INDEX wire_index = {};
+LOCATION_LIST all_sources = {};
+LOCATION_LIST failed_sources_for_multisink = {};
 
 typedef enum STATE {
     IDLE,
@@ -99,19 +550,262 @@ void delay(void) {
 
 void clean_up(void) {
     // Clean up dynamically allocated grid
-    for (int col = 0; col < num_columns; col++) {
-        free(grid[col]);
+    for (int i = 0; i < num_chunks; i++) {
+        if (chunks[i] != NULL) {
+            free_grid_arrays(chunks[i]);
+            if (chunks[i] != &grid) {
+                free(chunks[i]);
+            }
+        }
     }
-    free(grid);
+    free(chunks);
+    arena_free(&location_arena);
+    arena_free(&failed_arena);
+    arena_free(&source_arena);
+    bucket_queue_clear(&expansion_list);
+    free(expansion_list.head);
+    free(expansion_list.tail);
+    free(bfs_queue.cells);
+    free(sink_queue.cells);
+    free(targets);
+    free(dirty_blocks);
+    free(dirty_list);
+    for (int i = 0; i < num_nets; i++) {
+        free(nets[i].pins);
+        free(nets[i].cells);
+    }
+    free(nets);
+    solution_close();
+    free(trace_path);
+    free(wire_index.bins);
+    free(wire_index.node_cell);
+    free(wire_index.node_next);
+    free(obstruction_plane);
+    free(wire_plane);
+    free(pin_plane);
+    free(wave.free);
+    free(wave.visited);
+    free(wave.frontier);
+    free(wave.next);
+    free(wave.layer_start);
+    free(wave.entries);
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
+// Where -b writes the input file out as a binary netlist, NULL to route it
+char *binary_file = NULL;
+char *solution_file = NULL;
+char *checkpoint_file = NULL;
+int checkpoint_interval = 60;   // seconds between checkpoints, 0 for every connection
+time_t last_checkpoint = 0;
+char *resume_file = NULL;
+
+void usage(char *prog) {
+    printf("Usage: %s [-e bucket|bfs|astar|bidir|bitboard] [-s tree|closest] [-t first|all] [-l full|mod3] [-r search|pointer|straight] [-g column|tiled|sparse] [-b <binary file>] [-o <solution file>] [-c <checkpoint file>] [-i <seconds>] [-R <checkpoint file>] <input file>\n", prog);
+    printf("  -e  expansion engine (default: bucket)\n");
+    printf("  -s  sources for the extra sinks of a net (default: tree)\n");
+    printf("  -t  sinks the wave expands towards (default: first)\n");
+    printf("  -l  label storage (default: full)\n");
+    printf("  -r  traceback (default: pointer)\n");
+    printf("  -g  grid storage layout (default: column)\n");
+    printf("  -b  convert the input file to a binary netlist instead of routing it\n");
+    printf("  -o  write the routed paths to a solution file\n");
+    printf("  -c  write checkpoints of the router to this file\n");
+    printf("  -i  seconds between checkpoints, 0 for every connection (default: 60)\n");
+    printf("  -R  resume from a checkpoint, given the same input file and options\n");
+}
+
+char *parse_args(int argc, char *argv[]) {
+    char *file = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "bucket") == 0) {
+                engine = ENGINE_BUCKET;
+            } else if (strcmp(argv[i], "bfs") == 0) {
+                engine = ENGINE_BFS;
+            } else if (strcmp(argv[i], "astar") == 0) {
+                engine = ENGINE_ASTAR;
+            } else if (strcmp(argv[i], "bidir") == 0) {
+                engine = ENGINE_BIDIRECTIONAL;
+            } else if (strcmp(argv[i], "bitboard") == 0) {
+                engine = ENGINE_BITBOARD;
+            } else {
+                printf("Unknown expansion engine: %s\n", argv[i]);
+                usage(argv[0]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "tree") == 0) {
+                tree_seeding = true;
+            } else if (strcmp(argv[i], "closest") == 0) {
+                tree_seeding = false;
+            } else {
+                printf("Unknown source selection: %s\n", argv[i]);
+                usage(argv[0]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "first") == 0) {
+                multi_target = false;
+            } else if (strcmp(argv[i], "all") == 0) {
+                multi_target = true;
+            } else {
+                printf("Unknown sink targets: %s\n", argv[i]);
+                usage(argv[0]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "full") == 0) {
+                compact_labels = false;
+            } else if (strcmp(argv[i], "mod3") == 0) {
+                compact_labels = true;
+            } else {
+                printf("Unknown label storage: %s\n", argv[i]);
+                usage(argv[0]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "search") == 0) {
+                trace_mode = TRACE_SEARCH;
+            } else if (strcmp(argv[i], "pointer") == 0) {
+                trace_mode = TRACE_POINTER;
+            } else if (strcmp(argv[i], "straight") == 0) {
+                trace_mode = TRACE_STRAIGHT;
+            } else {
+                printf("Unknown traceback: %s\n", argv[i]);
+                usage(argv[0]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "column") == 0) {
+                layout = LAYOUT_COLUMN;
+            } else if (strcmp(argv[i], "tiled") == 0) {
+                layout = LAYOUT_TILED;
+            } else if (strcmp(argv[i], "sparse") == 0) {
+                layout = LAYOUT_SPARSE;
+            } else {
+                printf("Unknown grid layout: %s\n", argv[i]);
+                usage(argv[0]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            i++;
+            binary_file = argv[i];
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            i++;
+            solution_file = argv[i];
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            i++;
+            checkpoint_file = argv[i];
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            i++;
+            checkpoint_interval = atoi(argv[i]);
+        } else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+            i++;
+            resume_file = argv[i];
+        } else if (file == NULL && argv[i][0] != '-') {
+            file = argv[i];
+        } else {
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (compact_labels && (engine == ENGINE_ASTAR || engine == ENGINE_BIDIRECTIONAL)) {
+        // These relabel cells or add labels together, which needs the full value
+        printf("mod3 labels need the bucket, bfs or bitboard engine\n");
+        exit(1);
+    }
+
+    if (layout == LAYOUT_SPARSE && engine == ENGINE_BITBOARD) {
+        // Its row bitsets cover the whole grid
+        printf("The sparse grid cannot be used with the bitboard engine\n");
+        exit(1);
+    }
+
+    if (file == NULL) {
         printf("Need input file\n");
+        usage(argv[0]);
         exit(1);
     }
 
-    char *file = argv[1];
+    return file;
+}
+
+/**
+ * Get ready to route once the input file is parsed: list the sources, pick
+ * up from the checkpoint given with -R and open the solution file of -o.
+ */
+int start_routing() {
+    find_all_sources();
+
+    long solution_length = -1;
+    if (resume_file != NULL) {
+        if (checkpoint_read(resume_file, &solution_length) == ERROR) {
+            return ERROR;
+        }
+        if (solution_file != NULL && solution_length < 0) {
+            printf("WARNING: the checkpoint was taken without -o; %s will only have the routes from here on\n", solution_file);
+        }
+    }
+    if (solution_file != NULL && solution_open(solution_file, solution_length) == ERROR) {
+        return ERROR;
+    }
+    last_checkpoint = time(NULL);
+    return SUCCESS;
+}
+
+#ifdef NO_GRAPHICS
+/**
+ * Headless batch router: route the whole file in one go, with no window and
+ * no pause between steps, then print the results and how long it all took.
+ */
+int main(int argc, char *argv[]) {
+    char *file = parse_args(argc, argv);
+    printf("Input file: %s\n", file);
+
+    clock_t start = clock();
+    cur_state = IDLE;
+    if (parse_file(file) == ERROR) {
+        return 1;
+    }
+    if (binary_file != NULL) {
+        return (write_binary(binary_file) == ERROR) ? 1 : 0;
+    }
+    if (start_routing() == ERROR) {
+        return 1;
+    }
+    clock_t parsed = clock();
+
+    long num_steps = 0;
+    while (!done) {
+        run_lee_moore_algo();
+        num_steps++;
+    }
+    clock_t routed = clock();
+
+    double parse_secs = (double)(parsed - start) / CLOCKS_PER_SEC;
+    double route_secs = (double)(routed - parsed) / CLOCKS_PER_SEC;
+    printf("Routed %d of %d sinks (%d failed) in %ld steps\n",
+        num_successful_sinks, num_sinks, num_failed_sinks, num_steps);
+    printf("Parse time: %.3f s; Routing time: %.3f s", parse_secs, route_secs);
+    if (route_secs > 0) {
+        printf("; %.2f M expanded cells/s", num_expanded_cells / route_secs / 1e6);
+    }
+    printf("\n");
+
+    clean_up();
+    return (num_failed_sinks == 0) ? 0 : 2;
+}
+#else
+int main(int argc, char *argv[]) {
+    char *file = parse_args(argc, argv);
     printf("Input file: %s\n", file);
 
     // initialize display with WHITE background, and define a clean_up function
@@ -119,9 +813,15 @@ int main(int argc, char *argv[]) {
     init_world(0.,0.,1000.,1000.);
 
     cur_state = IDLE;
-    parse_file(file);
-
-    find_all_sources();
+    if (parse_file(file) == ERROR) {
+        return 1;
+    }
+    if (binary_file != NULL) {
+        return (write_binary(binary_file) == ERROR) ? 1 : 0;
+    }
+    if (start_routing() == ERROR) {
+        return 1;
+    }
 
     create_button("Window", "Go 1 Step", proceed_button_func);
     create_button("Window", "Go 1 State", proceed_fast_button_func);
@@ -129,6 +829,53 @@ int main(int argc, char *argv[]) {
     event_loop(button_press, mouse_move, key_press, drawscreen);
     return 0;
 }
+#endif
+
+/**
+ * Allocate the arrays of a GRID for num cells, all reading as untouched.
+ */
+void alloc_grid_arrays(GRID *g, int num) {
+    g->flags = (unsigned char *)my_malloc(num * sizeof(unsigned char));
+    g->wire_num = (int *)my_malloc(num * sizeof(int));
+    for (int i = 0; i < num; i++) {
+        g->flags[i] = 0;
+        g->wire_num[i] = -1;
+    }
+
+    g->value = NULL;
+    g->sink_value = NULL;
+    g->epoch = NULL;
+    g->label_plane = NULL;
+    g->pred_plane = NULL;
+    if (compact_labels) {
+        g->label_plane = (unsigned char *)my_malloc((num + 3) / 4);
+        memset(g->label_plane, 0xFF, (num + 3) / 4);
+    } else {
+        g->value = (int *)my_malloc(num * sizeof(int));
+        g->sink_value = (int *)my_malloc(num * sizeof(int));
+        g->epoch = (int *)my_malloc(num * sizeof(int));
+        for (int i = 0; i < num; i++) {
+            g->value[i] = -1;
+            g->sink_value[i] = -1;
+            g->epoch[i] = 0;
+        }
+    }
+    if (trace_mode != TRACE_SEARCH) {
+        // Always written when a cell is labelled, so never needs a reset
+        g->pred_plane = (unsigned char *)my_malloc((num + 3) / 4);
+        memset(g->pred_plane, 0, (num + 3) / 4);
+    }
+}
+
+void free_grid_arrays(GRID *g) {
+    free(g->flags);
+    free(g->wire_num);
+    free(g->value);
+    free(g->sink_value);
+    free(g->epoch);
+    free(g->label_plane);
+    free(g->pred_plane);
+}
 
 void init_grid() {
     t_report report;
@@ -137,36 +884,90 @@ void init_grid() {
     printf("width: %d, height: %d\n", report.top_width, report.top_height);
 #endif
 
-    float height = report.top_height;
-    float width = report.top_width;
-    float cell_height = height / num_rows;
-    float cell_width = width / num_columns;
+    cell_height = (float)report.top_height / num_rows;
+    cell_width = (float)report.top_width / num_columns;
 
     // Allocate memory for the grid
-    grid = (CELL **)my_malloc(num_columns * sizeof(CELL *));
-    for (int col = 0; col < num_columns; col++) {
-        grid[col] = (CELL *)my_malloc(num_rows * sizeof(CELL));
+    if (layout == LAYOUT_COLUMN) {
+        if ((long long)num_columns * num_rows > INT_MAX) {
+            printf("Grid of %d x %d cells is too large\n", num_columns, num_rows);
+            exit(1);
+        }
+        num_cells = num_columns * num_rows;
+    } else {
+        // Partial tiles at the bottom and right edges are padded out
+        tile_shift = (layout == LAYOUT_SPARSE) ? CHUNK_SHIFT : TILE_SHIFT;
+        int tile_size = 1 << tile_shift;
+        tile_rows = (num_rows + tile_size - 1) / tile_size;
+        long long tile_columns = (num_columns + tile_size - 1) / tile_size;
+        num_cells = tile_columns * tile_rows * tile_size * tile_size;
+        // The tiled layout has arrays of num_cells, which have to be indexed
+        // by an int. The sparse layout only has a table of chunks.
+        long long max_cells = (layout == LAYOUT_SPARSE) ? (long long)INT_MAX * CHUNK_CELLS : INT_MAX;
+        if (num_cells > max_cells) {
+            printf("Grid of %d x %d cells is too large\n", num_columns, num_rows);
+            exit(1);
+        }
     }
-
-    for (int col = 0; col < num_columns; col++) {
-        for (int row = 0; row < num_rows; row++) {
-            grid[col][row].x1 = cell_width * col;
-            grid[col][row].y1 = cell_height * row;
-            grid[col][row].x2 = cell_width + cell_width * col;
-            grid[col][row].y2 = cell_height + cell_height * row;
-            grid[col][row].text_x = grid[col][row].x2 - cell_width / 2.;
-            grid[col][row].text_y = grid[col][row].y2 - cell_height / 2.;
-            grid[col][row].is_obstruction = false;
-            grid[col][row].is_source = false;
-            grid[col][row].is_sink = false;
-            grid[col][row].is_routed = false;
-            grid[col][row].is_wire = false;
-            grid[col][row].wire_num = -1;
-            grid[col][row].value = -1;
-#ifdef DEBUG
-            printf("grid[%d][%d] = (%f, %f) (%f, %f) (%f, %f)\n", col, row, grid[col][row].x1, grid[col][row].y1, grid[col][row].x2, grid[col][row].y2, grid[col][row].text_x, grid[col][row].text_y);
-#endif
+    if (layout == LAYOUT_SPARSE) {
+        num_chunks = (int)(num_cells / CHUNK_CELLS);
+        chunk_cells = CHUNK_CELLS;
+        chunks = (GRID **)my_malloc(num_chunks * sizeof(GRID *));
+        for (int i = 0; i < num_chunks; i++) {
+            chunks[i] = NULL;
         }
+    } else {
+        num_chunks = 1;
+        chunk_cells = (int)num_cells;
+        chunks = (GRID **)my_malloc(sizeof(GRID *));
+        chunks[0] = &grid;
+        alloc_grid_arrays(&grid, chunk_cells);
+    }
+
+    if (engine == ENGINE_BITBOARD) {
+        // Only the bitboard engine reads the occupancy bitplanes
+        words_per_row = (num_columns + WORD_BITS - 1) / WORD_BITS;
+        int num_plane_words = words_per_row * num_rows;
+        obstruction_plane = (WORD *)my_malloc(num_plane_words * sizeof(WORD));
+        wire_plane = (WORD *)my_malloc(num_plane_words * sizeof(WORD));
+        pin_plane = (WORD *)my_malloc(num_plane_words * sizeof(WORD));
+        memset(obstruction_plane, 0, num_plane_words * sizeof(WORD));
+        memset(wire_plane, 0, num_plane_words * sizeof(WORD));
+        memset(pin_plane, 0, num_plane_words * sizeof(WORD));
+    }
+
+    if (compact_labels) {
+        size_t num_blocks = (num_cells + LABEL_BLOCK_CELLS - 1) / LABEL_BLOCK_CELLS;
+        dirty_blocks = (unsigned char *)my_malloc((num_blocks + 7) / 8);
+        memset(dirty_blocks, 0, (num_blocks + 7) / 8);
+    }
+
+    if (!tree_seeding) {
+        wire_index_init();
+    }
+
+    if (engine == ENGINE_ASTAR) {
+        // Seeds of a whole net can be up to the width + height of the grid
+        // apart in distance to the sink
+        bucket_queue_init(&expansion_list, num_columns + num_rows + NUM_BUCKETS);
+    } else {
+        bucket_queue_init(&expansion_list, NUM_BUCKETS);
+    }
+    // The sparse grid starts the queues small and lets them grow with the wave
+    int queue_capacity = (layout == LAYOUT_SPARSE) ? CHUNK_CELLS : chunk_cells;
+    if (engine == ENGINE_BFS || engine == ENGINE_BIDIRECTIONAL) {
+        ring_buffer_init(&bfs_queue, queue_capacity);
+    }
+    if (engine == ENGINE_BIDIRECTIONAL) {
+        ring_buffer_init(&sink_queue, queue_capacity);
+    }
+    if (engine == ENGINE_BITBOARD) {
+        int num_words = words_per_row * num_rows;
+        wave.free = (WORD *)my_malloc(num_words * sizeof(WORD));
+        wave.visited = (WORD *)my_malloc(num_words * sizeof(WORD));
+        wave.frontier = (WORD *)my_malloc(num_words * sizeof(WORD));
+        wave.next = (WORD *)my_malloc(num_words * sizeof(WORD));
+        wave.frontier_size = 0;
     }
 }
 
@@ -174,215 +975,607 @@ void draw_grid() {
     // Draw grid
     for (int col = 0; col < num_columns; col++) {
         for (int row = 0; row < num_rows; row++) {
+            CELL_ID id = cell_id(col, row);
+            float x1 = cell_width * col;
+            float y1 = cell_height * row;
+            float x2 = x1 + cell_width;
+            float y2 = y1 + cell_height;
+            float text_x = x2 - cell_width / 2.;
+            float text_y = y2 - cell_height / 2.;
             char text[10] = "";
-            if (grid[col][row].is_obstruction) {
+            if (has_flag(id, CELL_OBSTRUCTION)) {
                 // Draw obstruction
                 setcolor(BLUE);
-                fillrect(grid[col][row].x1, grid[col][row].y1, grid[col][row].x2, grid[col][row].y2);
+                fillrect(x1, y1, x2, y2);
                 setcolor(BLACK);
-                drawrect(grid[col][row].x1, grid[col][row].y1, grid[col][row].x2, grid[col][row].y2);
-            } else if (grid[col][row].wire_num != -1) {
+                drawrect(x1, y1, x2, y2);
+            } else if (get_wire_num(id) != -1) {
                 // Draw source and sinks
-                setcolor(DARKGREY + grid[col][row].wire_num);
-                fillrect(grid[col][row].x1, grid[col][row].y1, grid[col][row].x2, grid[col][row].y2);
+                setcolor(DARKGREY + get_wire_num(id));
+                fillrect(x1, y1, x2, y2);
                 setcolor(BLACK);
-                drawrect(grid[col][row].x1, grid[col][row].y1, grid[col][row].x2, grid[col][row].y2);
-                if (grid[col][row].is_wire && !(grid[col][row].is_source || grid[col][row].is_sink)) {
+                drawrect(x1, y1, x2, y2);
+                if (has_flag(id, CELL_WIRE) && !has_flag(id, CELL_PIN)) {
                     sprintf(text, "w");
-                } else if (grid[col][row].value != -1) {
-                    sprintf(text, "%d", grid[col][row].value);
+                } else if (is_labelled(col, row)) {
+                    sprintf(text, "%d", get_label(col, row));
                 } else {
-                    sprintf(text, "%d_%s", grid[col][row].wire_num, grid[col][row].is_source ? "sc" : "sk");
+                    sprintf(text, "%d_%s", get_wire_num(id), has_flag(id, CELL_SOURCE) ? "sc" : "sk");
                 }
-                drawtext(grid[col][row].text_x, grid[col][row].text_y, text, 150.);
-            } else if (grid[col][row].value != -1) {
+                drawtext(text_x, text_y, text, 150.);
+            } else if (is_labelled(col, row)) {
                 // Draw expansion list
                 setcolor(BLACK);
-                sprintf(text, "%d", grid[col][row].value);
-                drawrect(grid[col][row].x1, grid[col][row].y1, grid[col][row].x2, grid[col][row].y2);
-                drawtext(grid[col][row].text_x, grid[col][row].text_y, text, 150.);
+                sprintf(text, "%d", get_label(col, row));
+                drawrect(x1, y1, x2, y2);
+                drawtext(text_x, text_y, text, 150.);
+            } else if (get_sink_value(col, row) != -1) {
+                // Draw the wave grown from the sink
+                setcolor(BLACK);
+                drawrect(x1, y1, x2, y2);
+                setcolor(RED);
+                sprintf(text, "%d", get_sink_value(col, row));
+                drawtext(text_x, text_y, text, 150.);
             } else {
                 setcolor(BLACK);
-                drawrect(grid[col][row].x1, grid[col][row].y1, grid[col][row].x2, grid[col][row].y2);
+                drawrect(x1, y1, x2, y2);
 #ifdef DEBUG
                 sprintf(text, "(%d, %d)", col, row);
-                drawtext(grid[col][row].text_x, grid[col][row].text_y, text, 150.);
+                drawtext(text_x, text_y, text, 150.);
 #endif
             }
         }
     }
 }
 
-#define GRID_SIZE 0
-#define NUM_OBSTRUCTED_CELLS 1
-
-int parse_file(char *file) {
-    FILE *fp;
-    int ret = ERROR;
-
-    if (file != NULL) {
-        fp = fopen(file, "r");
-        if (fp == NULL) {
-            printf("Failed to open file: %s\n", file);
-        } else {
-            char *line;
-            size_t len = 0;
-            ssize_t read;
-
-            int line_num = 0;
-            int num_obstructed_cells = 0;
-            int num_wires_to_route = 0;
+/**
+ * qsort comparison of two cell ids by column, then row: the order the
+ * nested col/row loops over the grid visit them in.
+ */
+int compare_scan_order(const void *a, const void *b) {
+    CELL_ID id_a = *(const CELL_ID *)a;
+    CELL_ID id_b = *(const CELL_ID *)b;
+    if (cell_col(id_a) != cell_col(id_b)) {
+        return cell_col(id_a) - cell_col(id_b);
+    }
+    return cell_row(id_a) - cell_row(id_b);
+}
 
-            while ((read = getline(&line, &len, fp)) != -1) {
-#ifdef DEBUG
-                printf("parse_file[%d]: %s", line_num, line);
-#endif
-                switch (line_num) {
-                    case GRID_SIZE:
-                    {
-                        const char delim[2] = " ";
-                        char *token;
-
-                        token = strtok(line, delim);
-                        num_columns = atoi(token);
-                        token = strtok(NULL, delim);
-                        num_rows = atoi(token);
-                        printf("num_rows: %d num_columns: %d\n", num_rows, num_columns);
-                        init_grid();
-                    }
-                    break;
-                    case NUM_OBSTRUCTED_CELLS:
-                    {
-                        num_obstructed_cells = atoi(line);
-                        printf("num_obstructed_cells: %d\n", num_obstructed_cells);
-
-                        while (line_num - NUM_OBSTRUCTED_CELLS < num_obstructed_cells && (read = getline(&line, &len, fp)) != -1) {
-                            const char delim[2] = " ";
-                            char *token;
-                            token = strtok(line, delim);
-                            int col = atoi(token);
-                            token = strtok(NULL, delim);
-                            int row = atoi(token);
-                            printf("(%d, %d) is obstruction\n", col, row);
-                            grid[col][row].is_obstruction = true;
-                            line_num++;
-                        }
-                    }
-                    break;
-                    default: // NUM_WIRES_TO_ROUTE
-                    {
-                        num_wires_to_route = atoi(line);
-                        int cur_wire = 0;
-                        printf("num_wires_to_route: %d\n", num_wires_to_route);
-
-                        while (cur_wire < num_wires_to_route && (read = getline(&line, &len, fp)) != -1) {
-                            const char delim[2] = " ";
-                            char *token;
-                            token = strtok(line, delim);
-                            int num_pins = atoi(token);
-                            int idx = 0;
-                            printf("Number of pins: %d\n", num_pins);
-
-                            while (num_pins > 0) {
-                                token = strtok(NULL, delim);
-                                int col = atoi(token);
-                                token = strtok(NULL, delim);
-                                int row = atoi(token);
-
-                                // First one is a source; rest are sinks
-                                if (idx == 0) {
-                                    grid[col][row].is_source = true;
-                                    grid[col][row].wire_num = cur_wire;
-                                    printf("(%d, %d) is a source\n", col, row);
-                                    num_sources++;
-                                    idx++;
-                                } else {
-                                    grid[col][row].is_sink = true;
-                                    grid[col][row].wire_num = cur_wire;
-                                    printf("(%d, %d) is a sink\n", col, row);
-                                    num_sinks++;
-                                }
-
-                                num_pins--;
-                            }
-
-                            cur_wire++;
-                        }
+/**
+ * Reads integers straight out of the text of an .infile, keeping track of
+ * the line it is on for error messages.
+ */
+typedef struct SCANNER {
+    const char *pos;
+    const char *end;
+    int line;
+} SCANNER;
 
-                    }
-                    break;
-                }
-                line_num++;
-            }
+/**
+ * Skip whitespace and read the next non-negative decimal integer. Returns
+ * false, with a message, at the end of the input or on anything else.
+ */
+bool scan_int(SCANNER *s, const char *file, const char *what, int *value) {
+    while (s->pos < s->end && (*s->pos == ' ' || *s->pos == '\t' || *s->pos == '\r' || *s->pos == '\n')) {
+        if (*s->pos == '\n') {
+            s->line++;
+        }
+        s->pos++;
+    }
+    if (s->pos == s->end || *s->pos < '0' || *s->pos > '9') {
+        printf("%s:%d: expected %s\n", file, s->line, what);
+        return false;
+    }
 
-            fclose(fp);
-            if (line) {
-                free(line);
-            }
+    int v = 0;
+    while (s->pos < s->end && *s->pos >= '0' && *s->pos <= '9') {
+        int digit = *s->pos - '0';
+        if (v > (INT_MAX - digit) / 10) {
+            printf("%s:%d: %s is too large\n", file, s->line, what);
+            return false;
         }
-    } else {
-        printf("Invalid file!");
+        v = v * 10 + digit;
+        s->pos++;
     }
+    *value = v;
+    return true;
+}
 
-    printf("There are %d sources\n", num_sources);
-    return ret;
+/**
+ * Skip whitespace and, if the next thing is a word rather than a number,
+ * read it into word. Returns false, leaving the number to scan_int, if not.
+ */
+bool scan_word(SCANNER *s, char *word, int size) {
+    while (s->pos < s->end && (*s->pos == ' ' || *s->pos == '\t' || *s->pos == '\r' || *s->pos == '\n')) {
+        if (*s->pos == '\n') {
+            s->line++;
+        }
+        s->pos++;
+    }
+    int len = 0;
+    while (s->pos < s->end && ((*s->pos >= 'a' && *s->pos <= 'z') || (*s->pos >= 'A' && *s->pos <= 'Z'))) {
+        if (len < size - 1) {
+            word[len++] = *s->pos;
+        }
+        s->pos++;
+    }
+    word[len] = '\0';
+    return len > 0;
 }
 
-void drawscreen() {
-    clearscreen();  /* Should be first line of all drawscreens */
-    draw_grid();
+/**
+ * Read a "col row" pair and check it lies on the grid.
+ */
+bool scan_cell(SCANNER *s, const char *file, const char *what, int *col, int *row) {
+    if (!scan_int(s, file, what, col) || !scan_int(s, file, what, row)) {
+        return false;
+    }
+    if (!is_valid_coordinates(*col, *row)) {
+        printf("%s:%d: %s (%d, %d) is outside the %d x %d grid\n", file, s->line, what, *col, *row, num_columns, num_rows);
+        return false;
+    }
+    return true;
 }
 
-void button_press(float x, float y, int flags) {
-    printf("User clicked a button at coordinates (%f, %f)\n", x, y);
+/**
+ * Start the next net in nets, with room for num_pins pins.
+ */
+NET *add_net(int num_pins) {
+    NET *net = &nets[num_nets++];
+    net->pins = (CELL_ID *)my_malloc((num_pins > 0 ? num_pins : 1) * sizeof(CELL_ID));
+    net->num_pins = 0;
+    net->max_cells = (num_pins > 0 ? num_pins : 1);
+    net->cells = (CELL_ID *)my_malloc(net->max_cells * sizeof(CELL_ID));
+    net->num_cells = 0;
+    return net;
 }
 
-void proceed_button_func(void (*drawscreen_ptr) (void)) {
-    if (!done) {
-        run_lee_moore_algo();
-        drawscreen();
+/**
+ * Add a pin to the net; the first one is its source, the rest sinks.
+ */
+void add_pin(NET *net, int col, int row) {
+    CELL_ID id = cell_id(col, row);
+    if (net->num_pins == 0) {
+        set_flag(id, CELL_SOURCE);
+        net->cells[net->num_cells++] = id;
+#ifdef DEBUG
+        printf("(%d, %d) is a source\n", col, row);
+#endif
+        num_sources++;
     } else {
-        printf("Nothing else to do!\n");
+        set_flag(id, CELL_SINK);
+#ifdef DEBUG
+        printf("(%d, %d) is a sink\n", col, row);
+#endif
+        num_sinks++;
     }
+    set_wire_num(id, net - nets);
+    net->pins[net->num_pins++] = id;
 }
 
-void proceed_fast_button_func(void (*drawscreen_ptr) (void)) {
-    STATE state = cur_state;
-    while (state == cur_state && !done) {
-        run_lee_moore_algo();
-        drawscreen();
-        delay();
+void finish_net(NET *net) {
+    // Sinks are taken in the order a scan of the grid would find them
+    if (net->num_pins > 1) {
+        qsort(&net->pins[1], net->num_pins - 1, sizeof(CELL_ID), compare_scan_order);
     }
-
-    if (done) 
-        printf("Nothing else to do!\n");
 }
 
+/**
+ * Fill in the grid and the nets from the text of an .infile:
+ *
+ *     <columns> <rows>
+ *     <number of obstructions>
+ *     <col> <row>                                  (one cell)
+ *     rect <col1> <row1> <col2> <row2>             (a rectangle, corners included)
+ *     run <col> <row> <length>                     (length cells from col along the row)
+ *     <number of wires to route>
+ *     <number of pins> <col> <row> <col> <row> ... (one per wire, source first)
+ */
+int parse_buffer(const char *text, size_t size, const char *file) {
+    SCANNER s = {text, text + size, 1};
 
-void find_all_sources() {
-    printf("Finding all sources\n");
-    for (int col = 0; col < num_columns; col++) {
-        for (int row = 0; row < num_rows; row++) {
-            if (grid[col][row].is_source) {
-                LOCATION *loc = make_location(col, row);
-                add_to_list(&all_sources, loc);
-            }
-        }
+    if (!scan_int(&s, file, "number of columns", &num_columns) || !scan_int(&s, file, "number of rows", &num_rows)) {
+        return ERROR;
     }
-}
+    if (num_columns == 0 || num_rows == 0) {
+        printf("%s: grid of %d x %d cells is empty\n", file, num_columns, num_rows);
+        return ERROR;
+    }
+    printf("num_rows: %d num_columns: %d\n", num_rows, num_columns);
+    init_grid();
 
-bool find_new_source() {
-    /*
-    bool found = false;
-    for (int col = 0; col < num_columns; col++) {
-        for (int row = 0; row < num_rows; row++) {
-            // Find a new source to route
-            if (grid[col][row].is_source && !grid[col][row].is_routed) {
+    int num_obstruction_records = 0;
+    if (!scan_int(&s, file, "number of obstructions", &num_obstruction_records)) {
+        return ERROR;
+    }
+    printf("num_obstruction_records: %d\n", num_obstruction_records);
+    for (int i = 0; i < num_obstruction_records; i++) {
+        char word[8];
+        int col, row, col2, row2, length;
+        if (!scan_word(&s, word, sizeof(word))) {
+            if (!scan_cell(&s, file, "obstruction", &col, &row)) {
+                return ERROR;
+            }
+#ifdef DEBUG
+            printf("(%d, %d) is obstruction\n", col, row);
+#endif
+            set_flag(cell_id(col, row), CELL_OBSTRUCTION);
+        } else if (strcmp(word, "rect") == 0) {
+            if (!scan_cell(&s, file, "rectangle corner", &col, &row) ||
+                !scan_cell(&s, file, "rectangle corner", &col2, &row2)) {
+                return ERROR;
+            }
+#ifdef DEBUG
+            printf("(%d, %d)-(%d, %d) is obstruction\n", col, row, col2, row2);
+#endif
+            fill_flag((col < col2) ? col : col2, (row < row2) ? row : row2,
+                (col < col2) ? col2 : col, (row < row2) ? row2 : row, CELL_OBSTRUCTION);
+        } else if (strcmp(word, "run") == 0) {
+            if (!scan_cell(&s, file, "run start", &col, &row) || !scan_int(&s, file, "run length", &length)) {
+                return ERROR;
+            }
+            if (length == 0 || length > num_columns - col) {
+                printf("%s:%d: run of %d cells from (%d, %d) does not fit on the grid\n", file, s.line, length, col, row);
+                return ERROR;
+            }
+#ifdef DEBUG
+            printf("(%d, %d)-(%d, %d) is obstruction\n", col, row, col + length - 1, row);
+#endif
+            fill_flag(col, row, col + length - 1, row, CELL_OBSTRUCTION);
+        } else {
+            printf("%s:%d: unknown obstruction record '%s'\n", file, s.line, word);
+            return ERROR;
+        }
+    }
+
+    int num_wires_to_route = 0;
+    if (!scan_int(&s, file, "number of wires to route", &num_wires_to_route)) {
+        return ERROR;
+    }
+    // Every wire takes up at least a character of what is left of the file
+    if ((size_t)num_wires_to_route > (size_t)(s.end - s.pos)) {
+        printf("%s:%d: %d wires to route cannot fit in the rest of the file\n", file, s.line, num_wires_to_route);
+        return ERROR;
+    }
+    printf("num_wires_to_route: %d\n", num_wires_to_route);
+    nets = (NET *)my_malloc((num_wires_to_route > 0 ? num_wires_to_route : 1) * sizeof(NET));
+
+    for (int cur_wire = 0; cur_wire < num_wires_to_route; cur_wire++) {
+        int num_pins = 0;
+        if (!scan_int(&s, file, "number of pins", &num_pins)) {
+            return ERROR;
+        }
+        // and every pin at least three, as in " 0 0"
+        if ((size_t)num_pins > (size_t)(s.end - s.pos) / 3) {
+            printf("%s:%d: %d pins cannot fit in the rest of the file\n", file, s.line, num_pins);
+            return ERROR;
+        }
+#ifdef DEBUG
+        printf("Number of pins: %d\n", num_pins);
+#endif
+
+        NET *net = add_net(num_pins);
+        for (int i = 0; i < num_pins; i++) {
+            int col, row;
+            if (!scan_cell(&s, file, "pin", &col, &row)) {
+                return ERROR;
+            }
+            add_pin(net, col, row);
+        }
+        finish_net(net);
+    }
+    return SUCCESS;
+}
+
+// Binary netlist: the magic, the number of columns and rows as 32-bit little
+// endian, then the obstruction bitmap row by row, (num_columns + 7) / 8 bytes
+// a row with bit (col % 8) of byte (col / 8) standing for (col, row). Then a
+// varint with the number of nets, and for each net a varint with its number
+// of pins followed by a varint col and row per pin, source first. Varints
+// are 7 bits a byte, low bits first, with the top bit set on all but the last.
+#define BINARY_MAGIC "LEE\x01"
+#define BINARY_HEADER_SIZE 12
+
+/**
+ * Read a varint of up to 64 bits at *pos, not going past end.
+ */
+bool read_varint64(const unsigned char **pos, const unsigned char *end, long long *value) {
+    unsigned long long v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*pos == end) {
+            return false;
+        }
+        unsigned char byte = *(*pos)++;
+        v |= (unsigned long long)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            if (v > LLONG_MAX) {
+                return false;
+            }
+            *value = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Read a varint at *pos, not going past end, that has to fit in an int.
+ */
+bool read_varint(const unsigned char **pos, const unsigned char *end, int *value) {
+    long long v;
+    if (!read_varint64(pos, end, &v) || v > INT_MAX) {
+        return false;
+    }
+    *value = (int)v;
+    return true;
+}
+
+unsigned int read_u32(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+/**
+ * Fill in the grid and the nets from a binary netlist.
+ */
+int parse_binary(const unsigned char *data, size_t size, const char *file) {
+    const unsigned char *end = data + size;
+    unsigned int columns = read_u32(data + 4);
+    unsigned int rows = read_u32(data + 8);
+    if (columns == 0 || rows == 0 || columns > INT_MAX || rows > INT_MAX) {
+        printf("%s: bad grid size %u x %u\n", file, columns, rows);
+        return ERROR;
+    }
+    num_columns = columns;
+    num_rows = rows;
+    size_t bytes_per_row = (num_columns + 7) / 8;
+    if ((size - BINARY_HEADER_SIZE) / bytes_per_row < (size_t)num_rows) {
+        printf("%s: obstruction bitmap is cut short\n", file);
+        return ERROR;
+    }
+    printf("num_rows: %d num_columns: %d\n", num_rows, num_columns);
+    init_grid();
+
+    // Runs of set bits in a row go in with one fill_flag each
+    const unsigned char *bitmap = data + BINARY_HEADER_SIZE;
+    int num_obstructed_cells = 0;
+    for (int row = 0; row < num_rows; row++) {
+        const unsigned char *bits = bitmap + row * bytes_per_row;
+        int col = 0;
+        while (col < num_columns) {
+            if (bits[col / 8] == 0 && col % 8 == 0) {
+                col += 8;
+                continue;
+            }
+            if (!((bits[col / 8] >> (col % 8)) & 1)) {
+                col++;
+                continue;
+            }
+            int start = col;
+            while (col < num_columns && ((bits[col / 8] >> (col % 8)) & 1)) {
+                col++;
+            }
+            fill_flag(start, row, col - 1, row, CELL_OBSTRUCTION);
+            num_obstructed_cells += col - start;
+        }
+    }
+    printf("num_obstructed_cells: %d\n", num_obstructed_cells);
+
+    const unsigned char *pos = bitmap + num_rows * bytes_per_row;
+    int num_wires_to_route = 0;
+    // Every wire takes up at least a byte of what is left of the file
+    if (!read_varint(&pos, end, &num_wires_to_route) || (size_t)num_wires_to_route > (size_t)(end - pos)) {
+        printf("%s: bad number of wires to route\n", file);
+        return ERROR;
+    }
+    printf("num_wires_to_route: %d\n", num_wires_to_route);
+    nets = (NET *)my_malloc((num_wires_to_route > 0 ? num_wires_to_route : 1) * sizeof(NET));
+
+    for (int cur_wire = 0; cur_wire < num_wires_to_route; cur_wire++) {
+        int num_pins = 0;
+        if (!read_varint(&pos, end, &num_pins) || (size_t)num_pins > (size_t)(end - pos) / 2) {
+            printf("%s: bad number of pins for wire %d\n", file, cur_wire);
+            return ERROR;
+        }
+        NET *net = add_net(num_pins);
+        for (int i = 0; i < num_pins; i++) {
+            int col, row;
+            if (!read_varint(&pos, end, &col) || !read_varint(&pos, end, &row) || !is_valid_coordinates(col, row)) {
+                printf("%s: bad pin %d of wire %d\n", file, i, cur_wire);
+                return ERROR;
+            }
+            add_pin(net, col, row);
+        }
+        finish_net(net);
+    }
+    if (pos != end) {
+        printf("%s: %ld bytes of trailing data\n", file, (long)(end - pos));
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+void write_varint(FILE *fp, unsigned long long value) {
+    while (value >= 0x80) {
+        fputc((value & 0x7F) | 0x80, fp);
+        value >>= 7;
+    }
+    fputc(value, fp);
+}
+
+void write_u32(FILE *fp, unsigned int value) {
+    for (int i = 0; i < 4; i++) {
+        fputc((value >> (8 * i)) & 0xFF, fp);
+    }
+}
+
+/**
+ * Write the grid and nets just parsed as a binary netlist.
+ */
+int write_binary(char *file) {
+    FILE *fp = fopen(file, "wb");
+    if (fp == NULL) {
+        printf("Failed to open file: %s\n", file);
+        return ERROR;
+    }
+    fwrite(BINARY_MAGIC, 1, 4, fp);
+    write_u32(fp, num_columns);
+    write_u32(fp, num_rows);
+
+    int bytes_per_row = (num_columns + 7) / 8;
+    unsigned char *bits = (unsigned char *)my_malloc(bytes_per_row);
+    for (int row = 0; row < num_rows; row++) {
+        memset(bits, 0, bytes_per_row);
+        for (int col = 0; col < num_columns; col++) {
+            if (has_flag(cell_id(col, row), CELL_OBSTRUCTION)) {
+                bits[col / 8] |= 1 << (col % 8);
+            }
+        }
+        fwrite(bits, 1, bytes_per_row, fp);
+    }
+    free(bits);
+
+    write_varint(fp, num_nets);
+    for (int i = 0; i < num_nets; i++) {
+        write_varint(fp, nets[i].num_pins);
+        for (int j = 0; j < nets[i].num_pins; j++) {
+            write_varint(fp, cell_col(nets[i].pins[j]));
+            write_varint(fp, cell_row(nets[i].pins[j]));
+        }
+    }
+
+    if (fclose(fp) != 0) {
+        printf("Failed to write file: %s\n", file);
+        return ERROR;
+    }
+    printf("Wrote binary netlist %s\n", file);
+    return SUCCESS;
+}
+
+/**
+ * Parse an .infile, or a binary netlist if it starts with BINARY_MAGIC. The
+ * file is mapped into memory and read in place; when it can't be mapped (a
+ * pipe, say) it is read into one buffer instead.
+ */
+int parse_file(char *file) {
+    int ret = ERROR;
+
+    if (file != NULL) {
+        int fd = open(file, O_RDONLY);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1) {
+            printf("Failed to open file: %s\n", file);
+        } else {
+            size_t size = 0;
+            char *text = NULL;
+            bool mapped = false;
+
+            if (S_ISREG(st.st_mode) && st.st_size > 0) {
+                size = st.st_size;
+                text = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (text != MAP_FAILED) {
+                    madvise(text, size, MADV_SEQUENTIAL);
+                    mapped = true;
+                } else {
+                    text = NULL;
+                }
+            }
+            if (!mapped) {
+                size_t capacity = 4096;
+                text = (char *)my_malloc(capacity);
+                ssize_t count;
+                size = 0;
+                while ((count = read(fd, text + size, capacity - size)) > 0) {
+                    size += count;
+                    if (size == capacity) {
+                        capacity *= 2;
+                        text = (char *)my_realloc(text, capacity);
+                    }
+                }
+            }
+
+            if (size >= BINARY_HEADER_SIZE && memcmp(text, BINARY_MAGIC, 4) == 0) {
+                ret = parse_binary((const unsigned char *)text, size, file);
+            } else {
+                ret = parse_buffer(text, size, file);
+            }
+
+            if (mapped) {
+                munmap(text, size);
+            } else {
+                free(text);
+            }
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    } else {
+        printf("Invalid file!");
+    }
+
+    printf("There are %d sources\n", num_sources);
+    return ret;
+}
+
+void drawscreen() {
+    clearscreen();  /* Should be first line of all drawscreens */
+    draw_grid();
+}
+
+void button_press(float x, float y, int flags) {
+    printf("User clicked a button at coordinates (%f, %f)\n", x, y);
+}
+
+void proceed_button_func(void (*drawscreen_ptr) (void)) {
+    if (!done) {
+        run_lee_moore_algo();
+        drawscreen();
+    } else {
+        printf("Nothing else to do!\n");
+    }
+}
+
+void proceed_fast_button_func(void (*drawscreen_ptr) (void)) {
+    STATE state = cur_state;
+    while (state == cur_state && !done) {
+        run_lee_moore_algo();
+        drawscreen();
+        delay();
+    }
+
+    if (done) 
+        printf("Nothing else to do!\n");
+}
+
+
+void find_all_sources() {
+    printf("Finding all sources\n");
+    CELL_ID *sources = (CELL_ID *)my_malloc((num_nets > 0 ? num_nets : 1) * sizeof(CELL_ID));
+    int count = 0;
+    for (int i = 0; i < num_nets; i++) {
+        if (nets[i].num_pins > 0) {
+            sources[count++] = nets[i].pins[0];
+        }
+    }
+    qsort(sources, count, sizeof(CELL_ID), compare_scan_order);
+    for (int i = 0; i < count; i++) {
+        LOCATION *loc = make_location(&source_arena, cell_col(sources[i]), cell_row(sources[i]));
+        add_to_list(&all_sources, loc);
+    }
+    free(sources);
+}
+
+bool find_new_source() {
+    /*
+    bool found = false;
+    for (int col = 0; col < num_columns; col++) {
+        for (int row = 0; row < num_rows; row++) {
+            // Find a new source to route
+            if (has_flag(cell_id(col, row), CELL_SOURCE) && !has_flag(cell_id(col, row), CELL_ROUTED)) {
                 cur_src_col = col;
                 cur_src_row = row;
-                cur_wire_num = grid[col][row].wire_num;
+                cur_wire_num = get_wire_num(cell_id(col, row));
                 found = true;
-                grid[col][row].is_routed = true;
+                set_flag(cell_id(col, row), CELL_ROUTED);
                 break;
             }
         }
@@ -396,20 +1589,24 @@ bool find_new_source() {
     if (loc != NULL) {
         int col = loc->col;
         int row = loc->row;
-        if (!grid[col][row].is_routed) {
+        if (!has_flag(cell_id(col, row), CELL_ROUTED)) {
             cur_src_col = col;
             cur_src_row = row;
-            cur_wire_num = grid[cur_src_col][cur_src_row].wire_num;
-            grid[cur_src_col][cur_src_row].is_routed = true;
+            cur_wire_num = get_wire_num(cell_id(cur_src_col, cur_src_row));
+            set_flag(cell_id(cur_src_col, cur_src_row), CELL_ROUTED);
+            if (wire_index.bins != NULL) {
+                // Only the wires of this net are wanted from here on
+                wire_index_clear();
+            }
             found = true;
             printf("New current source: (%d, %d) [%d]\n", cur_src_col, cur_src_row, cur_wire_num);
         } else {
             printf("WARNING: Cannot find new source! (%d, %d) already routed!?\n", col, row);
         }
-        free(loc);
     } else {
         done = true;
         printf("No more sources to route!\n");
+        solution_close();
     }
     return found;
 }
@@ -417,58 +1614,120 @@ bool find_new_source() {
 void print_cell(int col, int row) {
     printf("(%d, %d): is_obstruction: %s, is_source: %s, is_sink: %s, is_routed: %s, is_wire: %s, wire_num: %d, value: %d\n",
         col, row,
-        grid[col][row].is_obstruction ? "true" : "false",
-        grid[col][row].is_source ? "true" : "false",
-        grid[col][row].is_sink ? "true" : "false",
-        grid[col][row].is_routed ? "true" : "false",
-        grid[col][row].is_wire ? "true" : "false",
-        grid[col][row].wire_num,
-        grid[col][row].value);
+        has_flag(cell_id(col, row), CELL_OBSTRUCTION) ? "true" : "false",
+        has_flag(cell_id(col, row), CELL_SOURCE) ? "true" : "false",
+        has_flag(cell_id(col, row), CELL_SINK) ? "true" : "false",
+        has_flag(cell_id(col, row), CELL_ROUTED) ? "true" : "false",
+        has_flag(cell_id(col, row), CELL_WIRE) ? "true" : "false",
+        get_wire_num(cell_id(col, row)),
+        get_label(col, row));
 }
 
 #define ABS(x) (((x) < 0) ? -(x) : (x))
 
-bool list_contains(LOCATION *list, int col, int row) {
-    bool contains = false;
-    LOCATION *cur = list;
-    while (cur != NULL) {
-        if (cur->col == col && cur->row == row) {
-            printf("List contains: (%d, %d)\n", col, row);
-            contains = true;
+void wire_index_init() {
+    wire_index.bin_columns = (num_columns + BIN_SIZE - 1) / BIN_SIZE;
+    wire_index.bin_rows = (num_rows + BIN_SIZE - 1) / BIN_SIZE;
+    wire_index.bins = (int *)my_malloc(wire_index.bin_columns * wire_index.bin_rows * sizeof(int));
+    wire_index.max_nodes = 64;
+    wire_index.node_cell = (CELL_ID *)my_malloc(wire_index.max_nodes * sizeof(CELL_ID));
+    wire_index.node_next = (int *)my_malloc(wire_index.max_nodes * sizeof(int));
+    for (int i = 0; i < wire_index.bin_columns * wire_index.bin_rows; i++) {
+        wire_index.bins[i] = -1;
+    }
+    wire_index.num_nodes = 0;
+}
+
+/**
+ * Empty the index, going through the bins that hold a cell only.
+ */
+void wire_index_clear() {
+    for (int node = 0; node < wire_index.num_nodes; node++) {
+        CELL_ID id = wire_index.node_cell[node];
+        wire_index.bins[(cell_col(id) >> BIN_SHIFT) * wire_index.bin_rows + (cell_row(id) >> BIN_SHIFT)] = -1;
+    }
+    wire_index.num_nodes = 0;
+}
+
+void wire_index_add(int col, int row) {
+    if (wire_index.num_nodes == wire_index.max_nodes) {
+        wire_index.max_nodes *= 2;
+        wire_index.node_cell = (CELL_ID *)my_realloc(wire_index.node_cell, wire_index.max_nodes * sizeof(CELL_ID));
+        wire_index.node_next = (int *)my_realloc(wire_index.node_next, wire_index.max_nodes * sizeof(int));
+    }
+    int bin = (col >> BIN_SHIFT) * wire_index.bin_rows + (row >> BIN_SHIFT);
+    int node = wire_index.num_nodes++;
+    wire_index.node_cell[node] = cell_id(col, row);
+    wire_index.node_next[node] = wire_index.bins[bin];
+    wire_index.bins[bin] = node;
+}
+
+/**
+ * Find the wire cell of net wire_num closest to (col, row), leaving out pins
+ * and sources that already failed. Bins are visited in rings of growing
+ * distance around the bin of (col, row), stopping once no cell in the next
+ * ring can be as close as the best one found, or every cell was looked at.
+ * Ties go to the cell a scan of the grid would find first.
+ */
+bool wire_index_nearest(int wire_num, int col, int row, int *best_col, int *best_row) {
+    int best_diff = INT_MAX;
+    int num_seen = 0;
+    *best_col = -1;
+    *best_row = -1;
+
+    int bin_col = col >> BIN_SHIFT;
+    int bin_row = row >> BIN_SHIFT;
+    int max_ring = (wire_index.bin_columns > wire_index.bin_rows) ? wire_index.bin_columns : wire_index.bin_rows;
+    for (int ring = 0; ring < max_ring; ring++) {
+        // Cells in this ring are at least this far away
+        int lower_bound = (ring == 0) ? 0 : (ring - 1) * BIN_SIZE + 1;
+        if (lower_bound > best_diff || num_seen == wire_index.num_nodes) {
             break;
         }
-        cur = cur->next;
+        for (int bc = bin_col - ring; bc <= bin_col + ring; bc++) {
+            if (bc < 0 || bc >= wire_index.bin_columns) {
+                continue;
+            }
+            // Whole columns of bins at the sides of the ring, only the two
+            // ends in between
+            int step = (bc == bin_col - ring || bc == bin_col + ring) ? 1 : 2 * ring;
+            for (int br = bin_row - ring; br <= bin_row + ring; br += step) {
+                if (br < 0 || br >= wire_index.bin_rows) {
+                    continue;
+                }
+                for (int node = wire_index.bins[bc * wire_index.bin_rows + br]; node != -1; node = wire_index.node_next[node]) {
+                    CELL_ID id = wire_index.node_cell[node];
+                    num_seen++;
+                    if ((get_flags(id) & (CELL_WIRE | CELL_PIN | CELL_FAILED_SOURCE)) != CELL_WIRE ||
+                        get_wire_num(id) != wire_num) {
+                        continue;
+                    }
+                    int c = cell_col(id);
+                    int r = cell_row(id);
+                    int diff = ABS(c - col) + ABS(r - row);
+                    if (diff < best_diff ||
+                        (diff == best_diff && (c < *best_col || (c == *best_col && r < *best_row)))) {
+                        best_diff = diff;
+                        *best_col = c;
+                        *best_row = r;
+                    }
+                }
+            }
+        }
     }
-    return contains;
+    return *best_col != -1;
 }
 
 bool find_new_source_for_sink(int sink_col, int sink_row) {
     bool found = false;
 
     // The idea is to find the part of the wire that is closest to the sink
-    int wire_num = grid[sink_col][sink_row].wire_num;
-    int smallest_diff = INT_MAX;
+    int wire_num = get_wire_num(cell_id(sink_col, sink_row));
     int closest_col = -1;
     int closest_row = -1;
 
     if (wire_num != -1) {
-        for (int col = 0; col < num_columns; col++) {
-            for (int row = 0; row < num_rows; row++) {
-                if (grid[col][row].wire_num == wire_num &&
-                    grid[col][row].is_wire &&
-                    !(list_contains(failed_sources_for_multisink, col, row)) &&
-                    !(grid[col][row].is_sink || grid[col][row].is_source)) {
-
-                    // Found the correct wire. Now see if it's close to the sink
-                    int diff = ABS(col - sink_col) + ABS(row - sink_row);
-                    if (diff < smallest_diff) {
-                        smallest_diff = diff;
-                        closest_col = col;
-                        closest_row = row;
-                    }
-                }
-            }
-        }
+        wire_index_nearest(wire_num, sink_col, sink_row, &closest_col, &closest_row);
     }
 
     if (closest_col != -1 && closest_row != -1) {
@@ -486,28 +1745,23 @@ bool find_new_source_for_sink(int sink_col, int sink_row) {
 
 bool find_new_sink(int src_col, int src_row) {
     bool found = false;
-    for (int col = 0; col < num_columns; col++) {
-        for (int row = 0; row < num_rows; row++) {
+    int wire_num = get_wire_num(cell_id(src_col, src_row));
+    if (wire_num != -1) {
+        NET *net = &nets[wire_num];
+        for (int i = 1; i < net->num_pins; i++) {
+            CELL_ID id = net->pins[i];
 #ifdef DEBUG
-            if (grid[col][row].is_sink) {
-                print_cell(col, row);
-            }
+            print_cell(cell_col(id), cell_row(id));
 #endif
             // Find a sink for the source (src_col, src_row)
-            if (grid[col][row].is_sink &&
-                !grid[col][row].is_routed &&
-                !grid[col][row].is_wire &&
-                grid[src_col][src_row].wire_num == grid[col][row].wire_num) {
-                cur_sink_col = col;
-                cur_sink_row = row;
+            if ((get_flags(id) & (CELL_SINK | CELL_ROUTED | CELL_WIRE)) == CELL_SINK) {
+                cur_sink_col = cell_col(id);
+                cur_sink_row = cell_row(id);
                 found = true;
+                printf("New current sink: (%d, %d) [%d]\n", cur_sink_col, cur_sink_row, cur_wire_num);
                 break;
             }
         }
-        if (found) {
-            printf("New current sink: (%d, %d) [%d]\n", cur_sink_col, cur_sink_row, cur_wire_num);
-            break;
-        }
     }
 
     printf("Found new sink? %d\n", found);
@@ -516,22 +1770,13 @@ bool find_new_sink(int src_col, int src_row) {
 }
 
 LOCATION *find_smallest_value() {
-    LOCATION *cur = expansion_list;
-    LOCATION *smallest = NULL;
-    int smallest_val = INT_MAX;
-
-    while (cur != NULL) {
-        if (grid[cur->col][cur->row].value < smallest_val) {
-            smallest_val = grid[cur->col][cur->row].value;
-            smallest = cur;
-        }
-        cur = cur->next;
-    }
+    // Remove the smallest one from the expansion list
+    LOCATION *smallest = bucket_queue_pop_min(&expansion_list);
 
     if (smallest != NULL) {
+#ifdef DEBUG
         printf("Smallest cell in expansion_list: (%d, %d)\n", smallest->col, smallest->row);
-        // Remove the smallest one from the expansion list
-        remove_from_list(&expansion_list, smallest);
+#endif
     } else {
         printf("ERROR: Cannot find the smallest cell in expansion_list\n");
     }
@@ -539,262 +1784,1585 @@ LOCATION *find_smallest_value() {
     return smallest;
 }
 
-void remove_from_list(LOCATION **head, LOCATION *remove) {
-    LOCATION *cur = *head;
+void bucket_queue_init(BUCKET_QUEUE *q, int num_buckets) {
+    q->num_buckets = num_buckets;
+    q->head = (LOCATION **)my_malloc(num_buckets * sizeof(LOCATION *));
+    q->tail = (LOCATION **)my_malloc(num_buckets * sizeof(LOCATION *));
+    for (int b = 0; b < num_buckets; b++) {
+        q->head[b] = NULL;
+        q->tail[b] = NULL;
+    }
+    q->min_key = 0;
+    q->size = 0;
+}
 
-    while (cur != NULL) {
-        if (cur->col == remove->col && cur->row == remove->row) {
-            // Found the item in the list
-            if (cur == *head) {
-                // First item in the list
-                *head = cur->next;
-                if (cur->next != NULL) {
-                    (*head)->prev = NULL;
-                }
-                cur->next = NULL;
-                cur->prev = NULL;
-            } else if (cur->next == NULL) {
-                // Last item in the list
-                cur->prev->next = NULL;
-                cur->next = NULL;
-                cur->prev = NULL;
-            } else {
-                // Middle of the list
-                cur->next->prev = cur->prev;
-                cur->prev->next = cur->next;
-                cur->next = NULL;
-                cur->prev = NULL;
-            }
-            break;
-        }
-        cur = cur->next;
+/**
+ * Bucket holding key. The window wraps around the buckets; a negative key
+ * still has to land on one of them.
+ */
+int bucket_of(BUCKET_QUEUE *q, int key) {
+    int b = key % q->num_buckets;
+    return (b < 0) ? b + q->num_buckets : b;
+}
+
+/**
+ * Make sure key falls in the window of keys the queue can hold. An empty
+ * queue moves its window to start at key; otherwise a key outside the
+ * window is an error.
+ */
+bool bucket_queue_ensure(BUCKET_QUEUE *q, int key) {
+    if (q->size == 0 && (key < q->min_key || key >= q->min_key + q->num_buckets)) {
+        // Start a new window; keys still in the old window can keep using it
+        q->min_key = key;
+    }
+    if (key < q->min_key || key >= q->min_key + q->num_buckets) {
+        printf("ERROR: key %d out of range of bucket queue [%d, %d)\n", key, q->min_key, q->min_key + q->num_buckets);
+        return false;
+    }
+    return true;
+}
+
+void bucket_queue_push(BUCKET_QUEUE *q, LOCATION *g, int key) {
+    if (!bucket_queue_ensure(q, key)) {
+        return;
+    }
+
+    // Append to the tail so cells with equal labels come out in FIFO order
+    int b = bucket_of(q, key);
+    g->next = NULL;
+    g->prev = q->tail[b];
+    if (q->tail[b] != NULL) {
+        q->tail[b]->next = g;
+    } else {
+        q->head[b] = g;
+    }
+    q->tail[b] = g;
+    q->size++;
+}
+
+void bucket_queue_push_front(BUCKET_QUEUE *q, LOCATION *g, int key) {
+    if (!bucket_queue_ensure(q, key)) {
+        return;
+    }
+
+    int b = bucket_of(q, key);
+    g->prev = NULL;
+    g->next = q->head[b];
+    if (q->head[b] != NULL) {
+        q->head[b]->prev = g;
+    } else {
+        q->tail[b] = g;
+    }
+    q->head[b] = g;
+    q->size++;
+}
+
+/**
+ * Pop the location with the smallest key. On return q->min_key holds the key
+ * the location was pushed with.
+ */
+LOCATION *bucket_queue_pop_min(BUCKET_QUEUE *q) {
+    if (q->size == 0) {
+        return NULL;
+    }
+
+    // Skip over empty buckets; at most num_buckets - 1 of them
+    while (q->head[bucket_of(q, q->min_key)] == NULL) {
+        q->min_key++;
+    }
+
+    int b = bucket_of(q, q->min_key);
+    LOCATION *g = q->head[b];
+    q->head[b] = g->next;
+    if (q->head[b] != NULL) {
+        q->head[b]->prev = NULL;
+    } else {
+        q->tail[b] = NULL;
+    }
+    g->next = NULL;
+    g->prev = NULL;
+    q->size--;
+
+    return g;
+}
+
+void bucket_queue_clear(BUCKET_QUEUE *q) {
+    // The locations themselves go back with the next arena_reset
+    for (int b = 0; b < q->num_buckets; b++) {
+        q->head[b] = NULL;
+        q->tail[b] = NULL;
+    }
+    q->min_key = 0;
+    q->size = 0;
+}
+
+// 2-bit fields of a bitplane, 4 cells per byte
+int get_2bit(unsigned char *plane, CELL_ID cell) {
+    return (plane[cell / 4] >> ((cell % 4) * 2)) & 3;
+}
+
+void set_2bit(unsigned char *plane, CELL_ID cell, int bits) {
+    int shift = (cell % 4) * 2;
+    plane[cell / 4] = (plane[cell / 4] & ~(3 << shift)) | (bits << shift);
+}
+
+/**
+ * Label of (col, row), or -1 if it is unlabelled. With compact labels this is
+ * the label mod 3.
+ */
+int get_label(int col, int row) {
+    if (engine == ENGINE_BITBOARD) {
+        return bitboard_get_label(col, row);
+    }
+    CELL_ID id = cell_id(col, row);
+    GRID *g = find_chunk(&id);
+    if (g == NULL) {
+        return -1;
+    }
+    if (compact_labels) {
+        int code = get_2bit(g->label_plane, id);
+        return (code == NO_LABEL) ? -1 : code;
+    }
+    return (g->epoch[id] == cur_epoch) ? g->value[id] : -1;
+}
+
+/**
+ * Make the labels of (col, row) belong to the current search, dropping
+ * whatever an earlier search left in them. Returns the arrays holding the
+ * cell, with its index into them in id.
+ */
+GRID *stamp_cell(int col, int row, CELL_ID *id) {
+    *id = cell_id(col, row);
+    GRID *g = make_chunk(id);
+    if (g->epoch != NULL && g->epoch[*id] != cur_epoch) {
+        g->epoch[*id] = cur_epoch;
+        g->value[*id] = -1;
+        g->sink_value[*id] = -1;
+    }
+    return g;
+}
+
+void set_label(int col, int row, int value) {
+    CELL_ID id;
+    if (compact_labels) {
+        id = cell_id(col, row);
+        CELL_ID block = id >> LABEL_BLOCK_SHIFT;
+        if (!(dirty_blocks[block / 8] & (1 << (block % 8)))) {
+            dirty_blocks[block / 8] |= 1 << (block % 8);
+            if (num_dirty == max_dirty) {
+                max_dirty = (max_dirty > 0) ? 2 * max_dirty : 1024;
+                dirty_list = (CELL_ID *)my_realloc(dirty_list, max_dirty * sizeof(CELL_ID));
+            }
+            dirty_list[num_dirty++] = block << LABEL_BLOCK_SHIFT;
+        }
+        GRID *g = make_chunk(&id);
+        set_2bit(g->label_plane, id, value % 3);
+    } else {
+        GRID *g = stamp_cell(col, row, &id);
+        g->value[id] = value;
+    }
+}
+
+int get_sink_value(int col, int row) {
+    CELL_ID id = cell_id(col, row);
+    GRID *g = find_chunk(&id);
+    return (g != NULL && g->epoch != NULL && g->epoch[id] == cur_epoch) ? g->sink_value[id] : -1;
+}
+
+void set_sink_value(int col, int row, int value) {
+    CELL_ID id;
+    GRID *g = stamp_cell(col, row, &id);
+    g->sink_value[id] = value;
+}
+
+bool is_labelled(int col, int row) {
+    return get_label(col, row) != -1;
+}
+
+/**
+ * See if (col, row) was labelled with value, as far as the label storage can
+ * tell.
+ */
+bool has_label(int col, int row, int value) {
+    if (engine == ENGINE_BITBOARD) {
+        return bitboard_has_label(col, row, value);
+    }
+    if (compact_labels) {
+        return get_label(col, row) == value % 3;
+    }
+    return get_label(col, row) == value;
+}
+
+/**
+ * See if coordinates (c, r) are valid. Only valid if c and r are both greater
+ * than 0 and less than the bounds of the grid.
+ */
+bool is_valid_coordinates(int col, int row) {
+    return (col >= 0 && row >=0 && col < num_columns && row < num_rows);
+}
+
+bool is_valid_neighbor(int col, int row, bool trace_back, int wire_num) {
+    bool valid = false;
+    if (!is_valid_coordinates(col, row)) {
+        // Off the grid, and no cell id to look at
+        return false;
+    }
+    CELL_ID id = cell_id(col, row);
+    if (trace_back) {
+        valid = (!has_flag(id, CELL_OBSTRUCTION) && is_labelled(col, row));
+        if (valid && has_flag(id, CELL_WIRE) && wire_num != -1) {
+            // Only way it's valid is if the wire is the same wire_num
+            if (!(get_wire_num(id) == wire_num)) {
+                valid = false;
+            }
+        }
+    } else {
+        valid = (!has_flag(id, CELL_OBSTRUCTION | CELL_WIRE) && !is_labelled(col, row));
+        if (valid && has_flag(id, CELL_PIN)) {
+            if (!(get_wire_num(id) == wire_num)) {
+                valid = false;
+            }
+        }
+    }
+    return valid;
+}
+
+
+void clear_failed_list() {
+    LOCATION *cur = failed_sources_for_multisink.head;
+    while (cur != NULL) {
+        clear_flag(cell_id(cur->col, cur->row), CELL_FAILED_SOURCE);
+        cur = cur->next;
+    }
+    failed_sources_for_multisink.head = NULL;
+    failed_sources_for_multisink.tail = NULL;
+    failed_sources_for_multisink.size = 0;
+}
+
+/**
+ * Drop the wave, along with every LOCATION handed out for it.
+ */
+void clear_expansion_list() {
+    bucket_queue_clear(&expansion_list);
+    arena_reset(&location_arena);
+
+    ring_buffer_clear(&bfs_queue);
+    ring_buffer_clear(&sink_queue);
+    bfs_layer = 1;
+    bfs_layer_left = 0;
+    bfs_next_layer = 0;
+    wave.frontier_size = 0;
+
+    expanding_sink_wave = false;
+    wave_layer = -1;
+    meet_length = INT_MAX;
+    meet_src_col = -1;
+    meet_src_row = -1;
+    meet_sink_col = -1;
+    meet_sink_row = -1;
+}
+
+/**
+ * Drop everything left over from routing a connection, including the
+ * sources that failed for it.
+ */
+void clear_connection() {
+    clear_expansion_list();
+    clear_failed_list();
+    arena_reset(&failed_arena);
+}
+
+int expansion_list_size() {
+    if (engine == ENGINE_BIDIRECTIONAL) {
+        // Once either wave runs dry the two can never meet
+        return (bfs_queue.size > 0 && sink_queue.size > 0) ? bfs_queue.size + sink_queue.size : 0;
+    }
+    if (engine == ENGINE_BITBOARD) {
+        return wave.frontier_size;
+    }
+    return (engine == ENGINE_BFS) ? bfs_queue.size : expansion_list.size;
+}
+
+void reset_current() {
+    cur_src_col = -1;
+    cur_src_row = -1;
+    cur_sink_col = -1;
+    cur_sink_row = -1;
+    cur_trace_col = -1;
+    cur_trace_row = -1;
+    cur_wire_num = -1;
+    cur_state = IDLE;
+
+    sink_found = false;
+    multiple_sink = false;
+    num_retries = 0;
+    clear_connection();
+
+}
+
+void reset_all() {
+    for (int i = 0; i < num_chunks; i++) {
+        GRID *g = chunks[i];
+        if (g == NULL) {
+            continue;
+        }
+        for (CELL_ID id = 0; id < chunk_cells; id++) {
+            g->flags[id] &= ~(CELL_ROUTED | CELL_WIRE);
+            if (!(g->flags[id] & CELL_PIN)) {
+                g->wire_num[id] = -1;
+            }
+        }
+    }
+    if (wire_plane != NULL) {
+        memset(wire_plane, 0, words_per_row * num_rows * sizeof(WORD));
+    }
+    if (wire_index.bins != NULL) {
+        wire_index_clear();
+    }
+    for (int i = 0; i < num_nets; i++) {
+        // Only the source is left
+        nets[i].num_cells = 0;
+        if (nets[i].num_pins > 0) {
+            nets[i].cells[nets[i].num_cells++] = nets[i].pins[0];
+        }
+    }
+    reset_grid();
+
+    cur_src_col = -1;
+    cur_src_row = -1;
+    cur_sink_col = -1;
+    cur_sink_row = -1;
+    cur_trace_col = -1;
+    cur_trace_row = -1;
+    cur_wire_num = -1;
+    cur_state = IDLE;
+
+    sink_found = false;
+    multiple_sink = false;
+
+    clear_connection();
+}
+
+void reset_grid() {
+    cur_epoch++;
+    if (cur_epoch == INT_MAX) {
+        // Ran out of epochs; start over with every cell stale
+        for (int i = 0; i < num_chunks; i++) {
+            if (chunks[i] != NULL && chunks[i]->epoch != NULL) {
+                memset(chunks[i]->epoch, 0, chunk_cells * sizeof(int));
+            }
+        }
+        cur_epoch = 1;
+    }
+    // Compact labels have no epoch, so clear the blocks the search labelled.
+    // Blocks line up with chunks; the last one of a dense grid may be short.
+    for (long long i = 0; i < num_dirty; i++) {
+        CELL_ID id = dirty_list[i];
+        CELL_ID block = id >> LABEL_BLOCK_SHIFT;
+        dirty_blocks[block / 8] &= ~(1 << (block % 8));
+        GRID *g = find_chunk(&id);
+        CELL_ID bytes = (chunk_cells + 3) / 4 - id / 4;
+        memset(&g->label_plane[id / 4], 0xFF, (bytes < LABEL_BLOCK_CELLS / 4) ? bytes : LABEL_BLOCK_CELLS / 4);
+    }
+    num_dirty = 0;
+}
+
+LOCATION *arena_alloc(ARENA *a) {
+    if (a->cur == NULL || a->used == ARENA_BLOCK_SIZE) {
+        // Move on to the next block, reusing the ones from before a reset
+        ARENA_BLOCK *next = (a->cur != NULL) ? a->cur->next : a->first;
+        if (next == NULL) {
+            next = (ARENA_BLOCK *)my_malloc(sizeof(ARENA_BLOCK));
+            next->next = NULL;
+            if (a->cur != NULL) {
+                a->cur->next = next;
+            } else {
+                a->first = next;
+            }
+            a->num_blocks++;
+        }
+        a->cur = next;
+        a->used = 0;
+    }
+    a->num_allocs++;
+    return &a->cur->nodes[a->used++];
+}
+
+void arena_reset(ARENA *a) {
+    a->cur = NULL;
+    a->used = 0;
+}
+
+void arena_free(ARENA *a) {
+    ARENA_BLOCK *block = a->first;
+    while (block != NULL) {
+        ARENA_BLOCK *next = block->next;
+        free(block);
+        block = next;
+    }
+    a->first = NULL;
+    a->cur = NULL;
+    a->used = 0;
+}
+
+LOCATION *make_location(ARENA *arena, int col, int row) {
+    LOCATION *g = arena_alloc(arena);
+    g->col = col;
+    g->row = row;
+    g->next = NULL;
+    g->prev = NULL;
+
+    return g;
+}
+
+typedef enum DIRECTION {
+    TOP,
+    LEFT,
+    RIGHT,
+    BOTTOM
+} DIRECTION;
+
+LOCATION *create_neighbors(int col, int row, bool trace_back, int wire_num, DIRECTION d) {
+    int c = -1, r = -1;
+    LOCATION *g = NULL;
+
+    switch (d) {
+        case TOP:
+            c = col;
+            r = row - 1;
+            break;
+        case BOTTOM:
+            c = col;
+            r = row + 1;
+            break;
+        case LEFT:
+            c = col - 1;
+            r = row;
+            break;
+        case RIGHT:
+            c = col + 1;
+            r = row;
+            break;
+    }
+#ifdef DEBUG
+    const char *text[] = {"TOP", "LEFT", "RIGHT", "BOTTOM"};
+    printf("Creating neighbors for (%d, %d) direction %s\n", col, row, text[d]);
+#endif
+
+
+    if (is_valid_neighbor(c, r, trace_back, wire_num)) {
+        g = make_location(&location_arena, c, r);
+#ifdef DEBUG
+        printf("Found %s neighbor (%d, %d)\n", text[d], c, r);
+#endif
+    }
+
+    return g;
+}
+
+LOCATION_LIST find_all_neighbors(int col, int row, bool trace_back, int wire_num) {
+    // Neighbors is deemed as the one on top, below, left, and right of (col, row)
+    LOCATION_LIST neighbors = {};
+#ifdef DEBUG
+    printf("Find all neighbors for (%d, %d)\n", col, row);
+#endif
+
+    for (int i = 0; i < 4; i++) {
+        DIRECTION d = (DIRECTION)((num_retries + i) % 4);
+        LOCATION *g = create_neighbors(col, row, trace_back, wire_num, d);
+        if (g != NULL) {
+            add_to_list(&neighbors, g);
+        }
+    }
+
+/*
+    // Top
+    c = col;
+    r = row - 1;
+    if (is_valid_neighbor(c, r, trace_back, wire_num)) {
+        LOCATION *g = make_location(c, r);
+        neighbors = g;
+#ifdef DEBUG
+        printf("Found top neighbor (%d, %d)\n", c, r);
+#endif
+    }
+
+    // Bottom
+    c = col;
+    r = row + 1;
+    if (is_valid_neighbor(c, r, trace_back, wire_num)) {
+        LOCATION *g = make_location(c, r);
+        add_to_list(&neighbors, g);
+#ifdef DEBUG
+        printf("Found bottom neighbor (%d, %d)\n", c, r);
+#endif
+    }
+
+    // Left
+    c = col - 1;
+    r = row;
+    if (is_valid_neighbor(c, r, trace_back, wire_num)) {
+        LOCATION *g = make_location(c, r);
+        add_to_list(&neighbors, g);
+#ifdef DEBUG
+        printf("Found left neighbor (%d, %d)\n", c, r);
+#endif
+    }
+
+    // Right
+    c = col + 1;
+    r = row;
+    if (is_valid_neighbor(c, r, trace_back, wire_num)) {
+        LOCATION *g = make_location(c, r);
+        add_to_list(&neighbors, g);
+#ifdef DEBUG
+        printf("Found right neighbor (%d, %d)\n", c, r);
+#endif
+    }
+*/
+    return neighbors;
+}
+
+void ring_buffer_init(RING_BUFFER *q, int capacity) {
+    q->capacity = capacity;
+    q->cells = (CELL_ID *)my_malloc(capacity * sizeof(CELL_ID));
+    ring_buffer_clear(q);
+}
+
+void ring_buffer_clear(RING_BUFFER *q) {
+    q->head = 0;
+    q->tail = 0;
+    q->size = 0;
+}
+
+void ring_buffer_push(RING_BUFFER *q, CELL_ID cell) {
+    if (q->size == q->capacity) {
+        // Only happens on the sparse grid, where the queues start small
+        if (q->capacity > INT_MAX / 2) {
+            printf("ERROR: wave of more than %d cells is too large\n", q->capacity);
+            exit(1);
+        }
+        int capacity = q->capacity * 2;
+        q->cells = (CELL_ID *)my_realloc(q->cells, capacity * sizeof(CELL_ID));
+        // Move the wrapped-around front of the queue after the old end
+        memcpy(&q->cells[q->capacity], q->cells, q->head * sizeof(CELL_ID));
+        q->tail = q->capacity + q->head;
+        q->capacity = capacity;
+    }
+    q->cells[q->tail] = cell;
+    q->tail = (q->tail + 1) % q->capacity;
+    q->size++;
+}
+
+CELL_ID ring_buffer_pop(RING_BUFFER *q) {
+    if (q->size == 0) {
+        return -1;
+    }
+    CELL_ID cell = q->cells[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->size--;
+    return cell;
+}
+
+// Column and row offsets of each DIRECTION
+const int dir_col[4] = {0, -1, 1, 0};
+const int dir_row[4] = {-1, 0, 0, 1};
+
+// TOP <-> BOTTOM and LEFT <-> RIGHT
+#define OPPOSITE(d) (3 - (d))
+
+/**
+ * Remember that the predecessor of (col, row) lies in direction d.
+ */
+void set_pred(int col, int row, int d) {
+    if (trace_mode != TRACE_SEARCH) {
+        CELL_ID id = cell_id(col, row);
+        GRID *g = make_chunk(&id);
+        set_2bit(g->pred_plane, id, d);
+    }
+}
+
+int get_pred(int col, int row) {
+    CELL_ID id = cell_id(col, row);
+    GRID *g = find_chunk(&id);
+    return (g != NULL) ? get_2bit(g->pred_plane, id) : TOP;
+}
+
+int direction_between(int from_col, int from_row, int to_col, int to_row) {
+    if (to_row < from_row) {
+        return TOP;
+    } else if (to_row > from_row) {
+        return BOTTOM;
+    }
+    return (to_col < from_col) ? LEFT : RIGHT;
+}
+
+/**
+ * Expand one cell of the wavefront using the BFS engine. Every label is the
+ * parent label + 1, so a FIFO of packed cell indices visits cells in the same
+ * order as the bucket queue without allocating a LOCATION per cell.
+ */
+void expand_bfs_step() {
+    if (bfs_layer_left == 0) {
+        // Start on the next layer
+        bfs_layer++;
+        bfs_layer_left = bfs_next_layer;
+        bfs_next_layer = 0;
+    }
+    bfs_layer_left--;
+
+    CELL_ID cell = ring_buffer_pop(&bfs_queue);
+    int col = cell_col(cell);
+    int row = cell_row(cell);
+    num_expanded_cells++;
+
+    // Check to see if the cell is the sink. If so, then we're done
+    if (reached_sink(col, row)) {
+        sink_found = true;
+        sink_label = bfs_layer;
+        printf("Found the sink (%d, %d)\n", col, row);
+        return;
+    }
+
+    int value = bfs_layer + 1;
+    for (int i = 0; i < 4; i++) {
+        int d = (num_retries + i) % 4;
+        int c = col + dir_col[d];
+        int r = row + dir_row[d];
+
+        if (is_valid_neighbor(c, r, false, cur_wire_num)) {
+            set_label(c, r, value);
+            set_pred(c, r, OPPOSITE(d));
+
+            // Check to see if we have expanded to sink. If so, then we're done
+            if (reached_sink(c, r)) {
+                sink_found = true;
+                sink_label = value;
+                printf("Found the sink (%d, %d)\n", c, r);
+                return;
+            }
+
+            ring_buffer_push(&bfs_queue, cell_id(c, r));
+            bfs_next_layer++;
+        }
+    }
+}
+
+int count_bits(WORD w) {
+#ifdef __GNUC__
+    return __builtin_popcountll(w);
+#else
+    int n = 0;
+    for (; w != 0; w &= w - 1) {
+        n++;
+    }
+    return n;
+#endif
+}
+
+int lowest_bit(WORD w) {
+#ifdef __GNUC__
+    return __builtin_ctzll(w);
+#else
+    int n = 0;
+    for (; (w & 1) == 0; w >>= 1) {
+        n++;
+    }
+    return n;
+#endif
+}
+
+/**
+ * Start a new search with the bitboard engine. Marks every cell the wave may
+ * enter for the current net as free, and clears the visited cells, the
+ * frontier and the stored layers.
+ */
+void bitboard_start() {
+    int num_words = words_per_row * num_rows;
+    for (int i = 0; i < num_words; i++) {
+        wave.free[i] = 0;
+        wave.visited[i] = 0;
+        wave.frontier[i] = 0;
+        wave.next[i] = 0;
+    }
+
+    // Everything but obstructions, wires and pins is free, a word at a time
+    WORD last_word = (num_columns % WORD_BITS) ? ((WORD)1 << (num_columns % WORD_BITS)) - 1 : ~(WORD)0;
+    for (int row = 0; row < num_rows; row++) {
+        for (int w = 0; w < words_per_row; w++) {
+            int i = row * words_per_row + w;
+            wave.free[i] = ~(obstruction_plane[i] | wire_plane[i] | pin_plane[i]);
+            if (w == words_per_row - 1) {
+                wave.free[i] &= last_word;
+            }
+
+            // Pins of the net being routed are free as well
+            WORD pins = pin_plane[i] & ~(wire_plane[i] | obstruction_plane[i]);
+            while (pins) {
+                int col = w * WORD_BITS + lowest_bit(pins);
+                if (get_wire_num(cell_id(col, row)) == cur_wire_num) {
+                    wave.free[i] |= pins & -pins;
+                }
+                pins &= pins - 1;
+            }
+        }
+    }
+    wave.layer = 1;
+    wave.frontier_size = 0;
+    wave.epoch = cur_epoch;
+    wave.num_layers = 0;
+    wave.num_entries = 0;
+}
+
+/**
+ * Keep word k of the layer being stored. Its bits are filled in later if
+ * they are not known yet.
+ */
+void bitboard_store_word(int k, WORD bits) {
+    if (wave.num_entries == wave.max_entries) {
+        wave.max_entries = (wave.max_entries > 0) ? 2 * wave.max_entries : 1024;
+        wave.entries = (LAYER_WORD *)my_realloc(wave.entries, wave.max_entries * sizeof(LAYER_WORD));
+    }
+    wave.entries[wave.num_entries].word = k;
+    wave.entries[wave.num_entries].bits = bits;
+    wave.num_entries++;
+}
+
+int compare_layer_words(const void *a, const void *b) {
+    return ((const LAYER_WORD *)a)->word - ((const LAYER_WORD *)b)->word;
+}
+
+/**
+ * Close the layer whose words were stored since the last one, sorting them
+ * for bitboard_has_label.
+ */
+void bitboard_end_layer() {
+    if (wave.num_layers + 2 > wave.max_layers) {
+        wave.max_layers = (wave.max_layers > 0) ? 2 * wave.max_layers : 256;
+        wave.layer_start = (int *)my_realloc(wave.layer_start, wave.max_layers * sizeof(int));
+    }
+    if (wave.num_layers == 0) {
+        wave.layer_start[0] = 0;
+    }
+    int first = wave.layer_start[wave.num_layers];
+    qsort(&wave.entries[first], wave.num_entries - first, sizeof(LAYER_WORD), compare_layer_words);
+    wave.num_layers++;
+    wave.layer_start[wave.num_layers] = wave.num_entries;
+}
+
+void bitboard_seed(int col, int row) {
+    int i = row * words_per_row + col / WORD_BITS;
+    WORD bit = (WORD)1 << (col % WORD_BITS);
+    if (!(wave.frontier[i] & bit)) {
+        if (wave.frontier[i] == 0) {
+            bitboard_store_word(i, 0);
+        }
+        wave.visited[i] |= bit;
+        wave.frontier[i] |= bit;
+        wave.frontier_size++;
+    }
+}
+
+/**
+ * See if (col, row) is in the layer labelled value of the current search,
+ * by a binary search of the words stored for that layer.
+ */
+bool bitboard_has_label(int col, int row, int value) {
+    if (wave.epoch != cur_epoch || value < 1 || value > wave.num_layers || !is_valid_coordinates(col, row)) {
+        return false;
+    }
+    int k = row * words_per_row + col / WORD_BITS;
+    int lo = wave.layer_start[value - 1];
+    int hi = wave.layer_start[value];
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (wave.entries[mid].word < k) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < wave.layer_start[value] && wave.entries[lo].word == k &&
+        ((wave.entries[lo].bits >> (col % WORD_BITS)) & 1);
+}
+
+/**
+ * Label of (col, row) in the current search, or -1. Goes through the layers
+ * one by one, so it is only meant for the display.
+ */
+int bitboard_get_label(int col, int row) {
+    if (wave.epoch != cur_epoch ||
+        !((wave.visited[row * words_per_row + col / WORD_BITS] >> (col % WORD_BITS)) & 1)) {
+        return -1;
+    }
+    for (int value = 1; value <= wave.num_layers; value++) {
+        if (bitboard_has_label(col, row, value)) {
+            return value;
+        }
+    }
+    // Seeded, but no layer stored yet
+    return 1;
+}
+
+/**
+ * Direction of a neighbor of (col, row) in the layer before value, the first
+ * in the same rotated order the other engines try neighbors in. That gives a
+ * shortest path, the one '-e bfs -r search' traces, but not always the one
+ * BFS's stored pointers give: those name the cell that labelled this one
+ * first, which depends on the order the wave was seeded in (-s closest, for
+ * one).
+ */
+int bitboard_pred(int col, int row, int value) {
+    for (int i = 0; i < 4; i++) {
+        int d = (num_retries + i) % 4;
+        if (bitboard_has_label(col + dir_col[d], row + dir_row[d], value - 1)) {
+            return d;
+        }
+    }
+    return TOP;
+}
+
+/**
+ * Work out word k of the next layer from the frontier words around it, and
+ * store it if any cell in it is new.
+ */
+int bitboard_spread(int k) {
+    int w = words_per_row;
+    int i = k % w;
+    // Left and right neighbors, carrying bits across word boundaries
+    WORD f = wave.frontier[k];
+    WORD spread = (f << 1) | (f >> 1);
+    if (i > 0) {
+        spread |= wave.frontier[k - 1] >> (WORD_BITS - 1);
+    }
+    if (i < w - 1) {
+        spread |= wave.frontier[k + 1] << (WORD_BITS - 1);
+    }
+    // Top and bottom neighbors
+    if (k >= w) {
+        spread |= wave.frontier[k - w];
+    }
+    if (k + w < w * num_rows) {
+        spread |= wave.frontier[k + w];
+    }
+
+    WORD n = spread & wave.free[k] & ~wave.visited[k];
+    if (n == 0) {
+        return 0;
+    }
+    wave.next[k] = n;
+    wave.visited[k] |= n;
+    bitboard_store_word(k, n);
+    return count_bits(n);
+}
+
+/**
+ * Advance the bitboard wave by one whole layer. Every frontier cell spreads
+ * to its four neighbors at once; the cells that are free and not yet visited
+ * form the next layer. Only the words of the frontier and the words next to
+ * them are gone through, so a step costs as much as the frontier is long.
+ */
+void expand_bitboard_step() {
+    int w = words_per_row;
+    int value = wave.layer + 1;
+    int next_size = 0;
+    num_expanded_cells += wave.frontier_size;
+
+    if (wave.num_layers == 0) {
+        // The seeds are layer 1; their words were noted as they came
+        for (int e = 0; e < wave.num_entries; e++) {
+            wave.entries[e].bits = wave.frontier[wave.entries[e].word];
+        }
+        bitboard_end_layer();
+    }
+
+    int first = wave.layer_start[wave.num_layers - 1];
+    int last = wave.layer_start[wave.num_layers];
+    for (int e = first; e < last; e++) {
+        int k = wave.entries[e].word;
+        int i = k % w;
+        next_size += bitboard_spread(k);
+        if (i > 0) {
+            next_size += bitboard_spread(k - 1);
+        }
+        if (i < w - 1) {
+            next_size += bitboard_spread(k + 1);
+        }
+        if (k >= w) {
+            next_size += bitboard_spread(k - w);
+        }
+        if (k + w < w * num_rows) {
+            next_size += bitboard_spread(k + w);
+        }
+    }
+    bitboard_end_layer();
+
+    // Empty the old frontier so it can take the layer after this one
+    for (int e = first; e < last; e++) {
+        wave.frontier[wave.entries[e].word] = 0;
+    }
+    WORD *tmp = wave.frontier;
+    wave.frontier = wave.next;
+    wave.next = tmp;
+    wave.frontier_size = next_size;
+    wave.layer = value;
+
+    // The first sink the new layer holds, in the order a row by row walk
+    // over it would come to them
+    if (multi_target) {
+        CELL_ID best = -1;
+        for (int i = 0; i < num_targets; i++) {
+            int col = cell_col(targets[i]);
+            int row = cell_row(targets[i]);
+            if (bitboard_has_label(col, row, value) && reached_sink(col, row) &&
+                (best == -1 || row < cell_row(best) || (row == cell_row(best) && col < cell_col(best)))) {
+                best = targets[i];
+            }
+        }
+        if (best != -1) {
+            reached_sink(cell_col(best), cell_row(best));
+            sink_found = true;
+        }
+    } else if (cur_sink_col != -1 && bitboard_has_label(cur_sink_col, cur_sink_row, value)) {
+        sink_found = true;
+    }
+
+    if (sink_found) {
+        sink_label = value;
+        printf("Found the sink (%d, %d)\n", cur_sink_col, cur_sink_row);
+    }
+}
+
+/**
+ * Relabel the sink half of a bidirectional search with source wave labels,
+ * walking from the meeting point down the sink wave to the sink. Afterwards
+ * the whole path counts up from the source, so the normal traceback works.
+ */
+void stitch_waves() {
+    int col = meet_sink_col;
+    int row = meet_sink_row;
+    int value = get_label(meet_src_col, meet_src_row) + 1;
+    int pred = direction_between(col, row, meet_src_col, meet_src_row);
+
+    while (true) {
+        set_label(col, row, value);
+        set_pred(col, row, pred);
+        if (get_sink_value(col, row) == 1) {
+            // Reached the sink the wave was grown from
+            cur_sink_col = col;
+            cur_sink_row = row;
+            break;
+        }
+
+        // Step to the neighbor one closer to the sink
+        int next = get_sink_value(col, row) - 1;
+        for (int d = 0; d < 4; d++) {
+            int c = col + dir_col[d];
+            int r = row + dir_row[d];
+            if (is_valid_coordinates(c, r) && get_sink_value(c, r) == next) {
+                col = c;
+                row = r;
+                pred = OPPOSITE(d);
+                break;
+            }
+        }
+        value++;
+    }
+    printf("Stitched waves at (%d, %d) and (%d, %d); path length %d\n", meet_src_col, meet_src_row, meet_sink_col, meet_sink_row, meet_length);
+}
+
+/**
+ * Expand one cell of the bidirectional search. The two waves take turns one
+ * layer at a time, always continuing with the smaller frontier. A meeting is
+ * recorded whenever a wave probes a cell labelled by the other one; once the
+ * layer that found it is finished the shortest meeting is stitched together.
+ */
+void expand_bidirectional_step() {
+    RING_BUFFER *q = expanding_sink_wave ? &sink_queue : &bfs_queue;
+    CELL_ID front = q->cells[q->head];
+    int front_label = expanding_sink_wave ? get_sink_value(cell_col(front), cell_row(front)) : get_label(cell_col(front), cell_row(front));
+
+    if (front_label != wave_layer) {
+        // Finished a layer; continue with whichever wave is smaller
+        expanding_sink_wave = sink_queue.size < bfs_queue.size;
+        q = expanding_sink_wave ? &sink_queue : &bfs_queue;
+        front = q->cells[q->head];
+        wave_layer = expanding_sink_wave ? get_sink_value(cell_col(front), cell_row(front)) : get_label(cell_col(front), cell_row(front));
+    }
+
+    CELL_ID cell = ring_buffer_pop(q);
+    int col = cell_col(cell);
+    int row = cell_row(cell);
+    num_expanded_cells++;
+
+    for (int i = 0; i < 4; i++) {
+        int d = (num_retries + i) % 4;
+        int c = col + dir_col[d];
+        int r = row + dir_row[d];
+
+        if (!is_valid_coordinates(c, r)) {
+            continue;
+        }
+
+        int other = expanding_sink_wave ? get_label(c, r) : get_sink_value(c, r);
+        if (other != -1) {
+            // Met the other wave
+            int length = wave_layer + other;
+            if (length < meet_length) {
+                meet_length = length;
+                meet_src_col = expanding_sink_wave ? c : col;
+                meet_src_row = expanding_sink_wave ? r : row;
+                meet_sink_col = expanding_sink_wave ? col : c;
+                meet_sink_row = expanding_sink_wave ? row : r;
+            }
+        } else if (is_valid_neighbor(c, r, false, cur_wire_num)) {
+            if (expanding_sink_wave) {
+                if (get_sink_value(c, r) == -1) {
+                    set_sink_value(c, r, wave_layer + 1);
+                    ring_buffer_push(q, cell_id(c, r));
+                }
+            } else {
+                set_label(c, r, wave_layer + 1);
+                set_pred(c, r, OPPOSITE(d));
+                ring_buffer_push(q, cell_id(c, r));
+            }
+        }
+    }
+
+    // Stop at the end of the layer that found a meeting
+    if (meet_length != INT_MAX) {
+        bool layer_done = (q->size == 0);
+        if (!layer_done) {
+            CELL_ID next = q->cells[q->head];
+            int next_label = expanding_sink_wave ? get_sink_value(cell_col(next), cell_row(next)) : get_label(cell_col(next), cell_row(next));
+            layer_done = (next_label != wave_layer);
+        }
+        if (layer_done) {
+            stitch_waves();
+            sink_found = true;
+            sink_label = get_label(cur_sink_col, cur_sink_row);
+            printf("Found the sink (%d, %d)\n", cur_sink_col, cur_sink_row);
+        }
+    }
+}
+
+/**
+ * Manhattan distance from (col, row) to the current sink, or to the nearest
+ * target when expanding towards all of them. It never overestimates the
+ * remaining wire length and changes by at most one per step, so it is a
+ * consistent heuristic for A*.
+ */
+int distance_to_sink(int col, int row) {
+    if (multi_target) {
+        int smallest = INT_MAX;
+        for (int i = 0; i < num_targets; i++) {
+            int diff = ABS(col - cell_col(targets[i])) + ABS(row - cell_row(targets[i]));
+            if (diff < smallest) {
+                smallest = diff;
+            }
+        }
+        return smallest;
+    }
+    return ABS(col - cur_sink_col) + ABS(row - cur_sink_row);
+}
+
+/**
+ * Check whether the wave has reached a sink it is looking for. When
+ * expanding towards all targets, any unrouted sink of the current net will
+ * do and it becomes the current sink.
+ */
+bool reached_sink(int col, int row) {
+    if (multi_target) {
+        CELL_ID id = cell_id(col, row);
+        if ((get_flags(id) & (CELL_SINK | CELL_ROUTED | CELL_WIRE)) == CELL_SINK &&
+            get_wire_num(id) == cur_wire_num) {
+            cur_sink_col = col;
+            cur_sink_row = row;
+            return true;
+        }
+        return false;
+    }
+    return (col == cur_sink_col && row == cur_sink_row);
+}
+
+/**
+ * Collect every unrouted sink of the current net into targets.
+ */
+void find_targets() {
+    if (targets == NULL) {
+        targets = (CELL_ID *)my_malloc((num_sinks > 0 ? num_sinks : 1) * sizeof(CELL_ID));
+    }
+
+    num_targets = 0;
+    NET *net = &nets[cur_wire_num];
+    for (int i = 1; i < net->num_pins; i++) {
+        if ((get_flags(net->pins[i]) & (CELL_SINK | CELL_ROUTED | CELL_WIRE)) == CELL_SINK) {
+            targets[num_targets++] = net->pins[i];
+        }
+    }
+    printf("Expanding towards %d sinks of net %d\n", num_targets, cur_wire_num);
+}
+
+/**
+ * Expand one cell of the wavefront using A*. The bucket queue is keyed by
+ * label + distance to the sink, which grows by 0 or 2 per step. Children that
+ * keep the key of their parent (i.e. step towards the sink) go to the front
+ * of their bucket, so ties are always broken in favour of the cell closest to
+ * the sink. A cell that is reached again with a smaller label is relabelled
+ * and pushed again; the stale entry is skipped when it is popped.
+ */
+void expand_astar_step() {
+    LOCATION *g = bucket_queue_pop_min(&expansion_list);
+    int col = g->col;
+    int row = g->row;
+    int key = expansion_list.min_key;
+
+    if (get_label(col, row) + distance_to_sink(col, row) != key) {
+        // Stale entry; the cell was relabelled with a smaller value
+        return;
+    }
+    num_expanded_cells++;
+
+    // Check to see if the cell is the sink. If so, then we're done
+    if (reached_sink(col, row)) {
+        sink_found = true;
+        sink_label = get_label(col, row);
+        printf("Found the sink (%d, %d)\n", col, row);
+        return;
+    }
+
+    int value = get_label(col, row) + 1;
+    for (int i = 0; i < 4; i++) {
+        int d = (num_retries + i) % 4;
+        int c = col + dir_col[d];
+        int r = row + dir_row[d];
+
+        // Anything already labelled was a valid neighbor when it was labelled
+        if (is_valid_neighbor(c, r, false, cur_wire_num) ||
+            (is_valid_coordinates(c, r) && get_label(c, r) > value)) {
+            set_label(c, r, value);
+            set_pred(c, r, OPPOSITE(d));
+
+            // Check to see if we have expanded to sink. If so, then we're done
+            if (reached_sink(c, r)) {
+                sink_found = true;
+                sink_label = value;
+                printf("Found the sink (%d, %d)\n", c, r);
+                return;
+            }
+
+            int f = value + distance_to_sink(c, r);
+            if (f == key) {
+                bucket_queue_push_front(&expansion_list, make_location(&location_arena, c, r), f);
+            } else {
+                bucket_queue_push(&expansion_list, make_location(&location_arena, c, r), f);
+            }
+        }
     }
 }
 
 /**
- * See if coordinates (c, r) are valid. Only valid if c and r are both greater
- * than 0 and less than the bounds of the grid.
+ * Label (col, row) as a source of the wave and add it to the expansion list
+ * of the current engine.
  */
-bool is_valid_coordinates(int col, int row) {
-    return (col >= 0 && row >=0 && col < num_columns && row < num_rows);
-}
-
-bool is_valid_neighbor(int col, int row, bool trace_back, int wire_num) {
-    bool valid = false;
-    if (trace_back) {
-        valid = (is_valid_coordinates(col, row) && !grid[col][row].is_obstruction && grid[col][row].value != -1);
-        if (valid && grid[col][row].is_wire && wire_num != -1) {
-            // Only way it's valid is if the wire is the same wire_num
-            if (!(grid[col][row].wire_num == wire_num)) {
-                valid = false;
-            }
-        }
+void seed_expansion(int col, int row) {
+    if (engine != ENGINE_BITBOARD) {
+        set_label(col, row, 1);
+    }
+    if (engine == ENGINE_BFS || engine == ENGINE_BIDIRECTIONAL) {
+        ring_buffer_push(&bfs_queue, cell_id(col, row));
+        bfs_layer_left++;
+    } else if (engine == ENGINE_BITBOARD) {
+        bitboard_seed(col, row);
     } else {
-        valid = (is_valid_coordinates(col, row) && !grid[col][row].is_obstruction && grid[col][row].value == -1 && !grid[col][row].is_wire);
-        if (valid && (grid[col][row].is_sink || grid[col][row].is_source)) {
-            if (!(grid[col][row].wire_num == wire_num)) {
-                valid = false;
-            }
+        int key = 1;
+        if (engine == ENGINE_ASTAR) {
+            key += distance_to_sink(col, row);
         }
+        bucket_queue_push(&expansion_list, make_location(&location_arena, col, row), key);
     }
-    return valid;
 }
 
+// Route solution written with -o: a "path" line per completed traceback,
+// giving the net, the sink and the run-length-encoded steps back to the
+// net, built up in a buffer that only goes to the file when it fills.
+#define WRITER_BUFFER_SIZE 65536
 
-void clear_failed_list() {
-    if (failed_sources_for_multisink != NULL) {
-        LOCATION *cur = failed_sources_for_multisink;
-        while (cur != NULL) {
-            LOCATION *next = cur->next;
-            free(cur);
-            cur = next;
-        }
+typedef struct WRITER {
+    FILE *fp;
+    char *buf;
+    int len;
+} WRITER;
 
-        failed_sources_for_multisink = NULL;
+WRITER solution = {};
+
+void writer_flush(WRITER *w) {
+    if (w->len > 0) {
+        fwrite(w->buf, 1, w->len, w->fp);
+        w->len = 0;
     }
 }
 
-void clear_expansion_list() {
-    if (expansion_list != NULL) {
-        LOCATION *cur = expansion_list;
-        while (cur != NULL) {
-            LOCATION *next = cur->next;
-            free(cur);
-            cur = next;
+void writer_puts(WRITER *w, const char *str) {
+    for (; *str != '\0'; str++) {
+        if (w->len == WRITER_BUFFER_SIZE) {
+            writer_flush(w);
         }
-
-        expansion_list = NULL;
+        w->buf[w->len++] = *str;
     }
 }
 
-void reset_current() {
-    cur_src_col = -1;
-    cur_src_row = -1;
-    cur_sink_col = -1;
-    cur_sink_row = -1;
-    cur_trace_col = -1;
-    cur_trace_row = -1;
-    cur_wire_num = -1;
-    cur_state = IDLE;
-
-    sink_found = false;
-    multiple_sink = false;
-    num_retries = 0;
-    clear_expansion_list();
-    clear_failed_list();
-
+void writer_int(WRITER *w, int value) {
+    char digits[12];
+    int n = sizeof(digits) - 1;
+    unsigned int v = (value < 0) ? -(unsigned int)value : value;
+    digits[n] = '\0';
+    do {
+        digits[--n] = '0' + v % 10;
+        v /= 10;
+    } while (v != 0);
+    if (value < 0) {
+        digits[--n] = '-';
+    }
+    writer_puts(w, &digits[n]);
 }
 
-void reset_all() {
-    for (int col = 0; col < num_columns; col++) {
-        for (int row = 0; row < num_rows; row++) {
-            grid[col][row].is_routed = false;
-            grid[col][row].is_wire = false;
-            if (!(grid[col][row].is_source || grid[col][row].is_sink)) {
-                grid[col][row].wire_num = -1;
+/**
+ * Open the solution file. When resuming, length is what it held at the
+ * checkpoint: anything written after that is dropped and writing carries on
+ * from there. Otherwise length is -1 and the file starts afresh.
+ */
+int solution_open(char *file, long length) {
+    if (length >= 0) {
+        solution.fp = fopen(file, "r+");
+        if (solution.fp != NULL) {
+            fseek(solution.fp, 0, SEEK_END);
+            if (ftell(solution.fp) < length || ftruncate(fileno(solution.fp), length) != 0) {
+                printf("Solution file %s is shorter than at the checkpoint\n", file);
+                fclose(solution.fp);
+                solution.fp = NULL;
+                return ERROR;
             }
-            grid[col][row].value = -1;
+            fseek(solution.fp, length, SEEK_SET);
         }
+    } else {
+        solution.fp = fopen(file, "w");
     }
+    if (solution.fp == NULL) {
+        printf("Failed to open file: %s\n", file);
+        return ERROR;
+    }
+    solution.buf = (char *)my_malloc(WRITER_BUFFER_SIZE);
+    solution.len = 0;
+    if (length >= 0) {
+        return SUCCESS;
+    }
+    writer_puts(&solution, "grid ");
+    writer_int(&solution, num_columns);
+    writer_puts(&solution, " ");
+    writer_int(&solution, num_rows);
+    writer_puts(&solution, "\n");
+    return SUCCESS;
+}
 
-    cur_src_col = -1;
-    cur_src_row = -1;
-    cur_sink_col = -1;
-    cur_sink_row = -1;
-    cur_trace_col = -1;
-    cur_trace_row = -1;
-    cur_wire_num = -1;
-    cur_state = IDLE;
-
-    sink_found = false;
-    multiple_sink = false;
+/**
+ * Write the end line with the sink counts and close the solution file.
+ */
+void solution_close() {
+    if (solution.fp == NULL) {
+        return;
+    }
+    writer_puts(&solution, "end ");
+    writer_int(&solution, num_successful_sinks);
+    writer_puts(&solution, " ");
+    writer_int(&solution, num_failed_sinks);
+    writer_puts(&solution, "\n");
+    writer_flush(&solution);
+    fclose(solution.fp);
+    solution.fp = NULL;
+    free(solution.buf);
+    solution.buf = NULL;
+}
 
-    clear_expansion_list();
-    clear_failed_list();
+void trace_path_add(int col, int row) {
+    if (trace_path_len == max_trace_path_len) {
+        max_trace_path_len = (max_trace_path_len > 0) ? 2 * max_trace_path_len : 64;
+        trace_path = (CELL_ID *)my_realloc(trace_path, max_trace_path_len * sizeof(CELL_ID));
+    }
+    trace_path[trace_path_len++] = cell_id(col, row);
 }
 
-void reset_grid() {
-    for (int col = 0; col < num_columns; col++) {
-        for (int row = 0; row < num_rows; row++) {
-            grid[col][row].value = -1;
+/**
+ * Write the finished traceback as
+ *
+ *     path <net> <sink col> <sink row> <step> <step> ...
+ *
+ * where each step is a direction, U, D, L or R (row - 1, row + 1, col - 1,
+ * col + 1), followed by the number of cells moved that way.
+ */
+void solution_write_path() {
+    if (solution.fp == NULL || trace_path_len == 0) {
+        return;
+    }
+    writer_puts(&solution, "path ");
+    writer_int(&solution, cur_wire_num);
+    writer_puts(&solution, " ");
+    writer_int(&solution, cell_col(trace_path[0]));
+    writer_puts(&solution, " ");
+    writer_int(&solution, cell_row(trace_path[0]));
+
+    int i = 1;
+    while (i < trace_path_len) {
+        int dc = cell_col(trace_path[i]) - cell_col(trace_path[i - 1]);
+        int dr = cell_row(trace_path[i]) - cell_row(trace_path[i - 1]);
+        int run = 1;
+        while (i + run < trace_path_len &&
+            cell_col(trace_path[i + run]) - cell_col(trace_path[i + run - 1]) == dc &&
+            cell_row(trace_path[i + run]) - cell_row(trace_path[i + run - 1]) == dr) {
+            run++;
         }
+        writer_puts(&solution, (dr < 0) ? " U" : (dr > 0) ? " D" : (dc < 0) ? " L" : " R");
+        writer_int(&solution, run);
+        i += run;
     }
+    writer_puts(&solution, "\n");
 }
 
-LOCATION *make_location(int col, int row) {
-    LOCATION *g = (LOCATION *)malloc(sizeof(LOCATION));
-    g->col = col;
-    g->row = row;
-    g->next = NULL;
-    g->prev = NULL;
-
-    return g;
+/**
+ * Turn (col, row) into a wire of the current net and add it to the net's
+ * cells, unless it is in there already. Another sink of the net that a
+ * traceback runs through is routed by it, so it is counted here; the sink
+ * the traceback started from is counted once the traceback is done.
+ */
+void lay_wire(int col, int row) {
+    CELL_ID id = cell_id(col, row);
+    if (!has_flag(id, CELL_WIRE | CELL_SOURCE)) {
+        if (has_flag(id, CELL_SINK) && !(col == cur_sink_col && row == cur_sink_row)) {
+            num_successful_sinks++;
+        }
+        NET *net = &nets[cur_wire_num];
+        if (net->num_cells == net->max_cells) {
+            net->max_cells *= 2;
+            net->cells = (CELL_ID *)my_realloc(net->cells, net->max_cells * sizeof(CELL_ID));
+        }
+        net->cells[net->num_cells++] = id;
+        if (wire_index.bins != NULL && !has_flag(id, CELL_PIN)) {
+            wire_index_add(col, row);
+        }
+    }
+    set_flag(id, CELL_WIRE);
 }
 
-typedef enum DIRECTION {
-    TOP,
-    LEFT,
-    RIGHT,
-    BOTTOM
-} DIRECTION;
+// Checkpoints of the router written with -c, and read back with -R. One is
+// only ever taken between connections, when the grid holds nothing but the
+// wires laid so far and the flags below, so it comes down to those and the
+// few variables that say which connection is next:
+//
+//     CHECKPOINT_MAGIC, then varints: columns, rows, number of nets, the
+//     engine, source selection, targets, labels and traceback options,
+//     cur_src_col + 1, cur_src_row + 1, cur_sink_col + 1, cur_sink_row + 1,
+//     cur_wire_num + 1, multiple_sink, num_retries, num_successful_sinks,
+//     num_failed_sinks, num_expanded_cells, sources left in all_sources and
+//     the length of the solution file + 1 (0 without one). Then for each net
+//     its number of pins and the CHECKPOINT_FLAGS of each, in pin order, and
+//     its number of cells followed by the col, row and CHECKPOINT_FLAGS of
+//     each.
+#define CHECKPOINT_MAGIC "LEC\x01"
+#define CHECKPOINT_FLAGS (CELL_ROUTED | CELL_WIRE | CELL_FAILED_SOURCE)
 
-LOCATION *create_neighbors(int col, int row, bool trace_back, int wire_num, DIRECTION d) {
-    int c, r;
-    char *text = "";
-    LOCATION *g = NULL;
+/**
+ * Write a checkpoint of the router as it is between two connections. It
+ * goes to a temporary file first and is renamed over the old one, so a
+ * crash part way through leaves the last checkpoint intact.
+ */
+int checkpoint_write(char *file) {
+    char *tmp_file = (char *)my_malloc(strlen(file) + 5);
+    sprintf(tmp_file, "%s.tmp", file);
+    FILE *fp = fopen(tmp_file, "wb");
+    if (fp == NULL) {
+        printf("Failed to open file: %s\n", tmp_file);
+        free(tmp_file);
+        return ERROR;
+    }
 
-    switch (d) {
-        case TOP:
-            c = col;
-            r = row - 1;
-            text = "TOP";
-            break;
-        case BOTTOM:
-            c = col;
-            r = row + 1;
-            text = "BOTTOM";
-            break;
-        case LEFT:
-            c = col - 1;
-            r = row;
-            text = "LEFT";
-            break;
-        case RIGHT:
-            c = col + 1;
-            r = row;
-            text = "RIGHT";
-            break;
+    // Whatever the checkpoint says was routed has to be in the solution file
+    long solution_length = -1;
+    if (solution.fp != NULL) {
+        writer_flush(&solution);
+        fflush(solution.fp);
+        solution_length = ftell(solution.fp);
     }
-    printf("Creating neighbors for (%d, %d) direction %s\n", col, row, text);
 
+    fwrite(CHECKPOINT_MAGIC, 1, 4, fp);
+    long long header[] = {num_columns, num_rows, num_nets,
+        engine, tree_seeding, multi_target, compact_labels, trace_mode,
+        cur_src_col + 1, cur_src_row + 1, cur_sink_col + 1, cur_sink_row + 1, cur_wire_num + 1,
+        multiple_sink, num_retries, num_successful_sinks, num_failed_sinks, num_expanded_cells,
+        all_sources.size};
+    for (unsigned int i = 0; i < sizeof(header) / sizeof(header[0]); i++) {
+        write_varint(fp, header[i]);
+    }
+    write_varint(fp, solution_length + 1);
 
-    if (is_valid_neighbor(c, r, trace_back, wire_num)) {
-        g = make_location(c, r);
-        printf("Found %s neighbor (%d, %d)\n", text, c, r);
+    for (int i = 0; i < num_nets; i++) {
+        NET *net = &nets[i];
+        write_varint(fp, net->num_pins);
+        for (int j = 0; j < net->num_pins; j++) {
+            write_varint(fp, get_flags(net->pins[j]) & CHECKPOINT_FLAGS);
+        }
+        write_varint(fp, net->num_cells);
+        for (int j = 0; j < net->num_cells; j++) {
+            write_varint(fp, cell_col(net->cells[j]));
+            write_varint(fp, cell_row(net->cells[j]));
+            write_varint(fp, get_flags(net->cells[j]) & CHECKPOINT_FLAGS);
+        }
     }
 
-    return g;
+    int ret = SUCCESS;
+    if (fclose(fp) != 0 || rename(tmp_file, file) != 0) {
+        printf("Failed to write checkpoint %s\n", file);
+        ret = ERROR;
+    } else {
+        printf("Wrote checkpoint %s\n", file);
+    }
+    free(tmp_file);
+    return ret;
 }
 
-LOCATION *find_all_neighbors(int col, int row, bool trace_back, int wire_num) {
-    // Neighbors is deemed as the one on top, below, left, and right of (col, row)
-    LOCATION *neighbors = NULL;
-    printf("Find all neighbors for (%d, %d)\n", col, row);
-
-    for (int i = 0; i < 4; i++) {
-        DIRECTION d = (DIRECTION)((num_retries + i) % 4);
-        LOCATION *g = create_neighbors(col, row, trace_back, wire_num, d);
-        if (g != NULL) {
-            add_to_list(&neighbors, g);
+/**
+ * Set the CHECKPOINT_FLAGS in flags on cell id, one at a time so set_flag
+ * keeps the bitplanes in step.
+ */
+void checkpoint_set_flags(CELL_ID id, int flags) {
+    for (int flag = CELL_ROUTED; flag <= CELL_FAILED_SOURCE; flag <<= 1) {
+        if (flags & flag & CHECKPOINT_FLAGS) {
+            set_flag(id, flag);
         }
     }
-
-/*
-    // Top
-    c = col;
-    r = row - 1;
-    if (is_valid_neighbor(c, r, trace_back, wire_num)) {
-        LOCATION *g = make_location(c, r);
-        neighbors = g;
-#ifdef DEBUG
-        printf("Found top neighbor (%d, %d)\n", c, r);
-#endif
+    if (flags & CELL_FAILED_SOURCE) {
+        add_to_list(&failed_sources_for_multisink, make_location(&failed_arena, cell_col(id), cell_row(id)));
     }
+}
 
-    // Bottom
-    c = col;
-    r = row + 1;
-    if (is_valid_neighbor(c, r, trace_back, wire_num)) {
-        LOCATION *g = make_location(c, r);
-        add_to_list(&neighbors, g);
-#ifdef DEBUG
-        printf("Found bottom neighbor (%d, %d)\n", c, r);
-#endif
+/**
+ * Put the router back the way checkpoint_write found it. The same input file
+ * has to have been parsed, and find_all_sources run, already. Returns the
+ * length the solution file had, or -1 if there was none, through
+ * solution_length.
+ */
+int checkpoint_read(char *file, long *solution_length) {
+    FILE *fp = fopen(file, "rb");
+    if (fp == NULL) {
+        printf("Failed to open file: %s\n", file);
+        return ERROR;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    unsigned char *data = (unsigned char *)my_malloc(size > 0 ? size : 1);
+    bool complete = (size >= 4 && fread(data, 1, size, fp) == (size_t)size);
+    fclose(fp);
+    if (!complete || memcmp(data, CHECKPOINT_MAGIC, 4) != 0) {
+        printf("%s is not a checkpoint\n", file);
+        free(data);
+        return ERROR;
     }
 
-    // Left
-    c = col - 1;
-    r = row;
-    if (is_valid_neighbor(c, r, trace_back, wire_num)) {
-        LOCATION *g = make_location(c, r);
-        add_to_list(&neighbors, g);
-#ifdef DEBUG
-        printf("Found left neighbor (%d, %d)\n", c, r);
-#endif
+    const unsigned char *pos = data + 4;
+    const unsigned char *end = data + size;
+    // All but the expanded cell count and the solution length fit in an int
+    long long header[20];
+    for (int i = 0; i < 20; i++) {
+        if (!read_varint64(&pos, end, &header[i]) || (i != 17 && i != 19 && header[i] > INT_MAX)) {
+            printf("%s: checkpoint is cut short\n", file);
+            free(data);
+            return ERROR;
+        }
+    }
+    int expected[] = {num_columns, num_rows, num_nets, engine, tree_seeding, multi_target, compact_labels, trace_mode};
+    for (int i = 0; i < 8; i++) {
+        if (header[i] != expected[i]) {
+            printf("%s: checkpoint is of a different input file or was taken with other -e, -s, -t, -l or -r options\n", file);
+            free(data);
+            return ERROR;
+        }
+    }
+    if (header[18] > all_sources.size) {
+        printf("%s: checkpoint has more sources left than there are\n", file);
+        free(data);
+        return ERROR;
     }
 
-    // Right
-    c = col + 1;
-    r = row;
-    if (is_valid_neighbor(c, r, trace_back, wire_num)) {
-        LOCATION *g = make_location(c, r);
-        add_to_list(&neighbors, g);
-#ifdef DEBUG
-        printf("Found right neighbor (%d, %d)\n", c, r);
-#endif
+    // Nets first, so a bad file is caught before the current connection changes
+    for (int i = 0; i < num_nets; i++) {
+        NET *net = &nets[i];
+        int num_pins = 0;
+        if (!read_varint(&pos, end, &num_pins) || num_pins != net->num_pins) {
+            printf("%s: checkpoint does not match net %d\n", file, i);
+            free(data);
+            return ERROR;
+        }
+        for (int j = 0; j < num_pins; j++) {
+            int flags = 0;
+            if (!read_varint(&pos, end, &flags)) {
+                printf("%s: checkpoint is cut short\n", file);
+                free(data);
+                return ERROR;
+            }
+            checkpoint_set_flags(net->pins[j], flags);
+        }
+
+        int num_net_cells = 0;
+        if (!read_varint(&pos, end, &num_net_cells) || (size_t)num_net_cells > (size_t)(end - pos) / 3) {
+            printf("%s: checkpoint is cut short\n", file);
+            free(data);
+            return ERROR;
+        }
+        if (num_net_cells > net->max_cells) {
+            net->max_cells = num_net_cells;
+            net->cells = (CELL_ID *)my_realloc(net->cells, net->max_cells * sizeof(CELL_ID));
+        }
+        net->num_cells = 0;
+        for (int j = 0; j < num_net_cells; j++) {
+            int col, row, flags;
+            if (!read_varint(&pos, end, &col) || !read_varint(&pos, end, &row) || !read_varint(&pos, end, &flags) ||
+                !is_valid_coordinates(col, row)) {
+                printf("%s: bad cell %d of net %d in checkpoint\n", file, j, i);
+                free(data);
+                return ERROR;
+            }
+            CELL_ID id = cell_id(col, row);
+            net->cells[net->num_cells++] = id;
+            checkpoint_set_flags(id, flags);
+            if (!has_flag(id, CELL_PIN)) {
+                set_wire_num(id, i);
+                if (wire_index.bins != NULL && has_flag(id, CELL_WIRE) && i == header[12] - 1) {
+                    wire_index_add(col, row);
+                }
+            }
+        }
     }
-*/
-    return neighbors;
+    free(data);
+
+    cur_src_col = header[8] - 1;
+    cur_src_row = header[9] - 1;
+    cur_sink_col = header[10] - 1;
+    cur_sink_row = header[11] - 1;
+    cur_wire_num = header[12] - 1;
+    multiple_sink = header[13];
+    num_retries = header[14];
+    num_successful_sinks = header[15];
+    num_failed_sinks = header[16];
+    num_expanded_cells = header[17];
+    while (all_sources.size > header[18]) {
+        pop_from_list(&all_sources);
+    }
+    *solution_length = (long)header[19] - 1;
+    cur_state = IDLE;
+
+    printf("Resumed from checkpoint %s: %d sinks routed, %d failed, %d sources left\n",
+        file, num_successful_sinks, num_failed_sinks, all_sources.size);
+    return SUCCESS;
 }
 
 void run_lee_moore_algo() {
@@ -810,65 +3378,140 @@ void run_lee_moore_algo() {
         }
 
         if (!find_new_sink(cur_src_col, cur_src_row)) {
-            printf("ERROR: Cannot find sink for (%d, %d) [%d]\n", cur_src_col, cur_src_row, cur_wire_num);
+            // A net with a single pin has nothing to route. Flooding the grid
+            // would only fail, and A* would have no target to head for.
+            printf("Net %d has no sink to route; skipping it\n", cur_wire_num);
+            reset_current();
+            return;
         }
     }
 
-    if (grid[cur_src_col][cur_src_row].value == -1) {
-        // First step
-        grid[cur_src_col][cur_src_row].value = 1;
-        LOCATION *g = make_location(cur_src_col, cur_src_row);
-        expansion_list = g;
-        printf("Labeled source (%d, %d) as first step!\n", cur_src_col, cur_src_row);
+    if (!is_labelled(cur_src_col, cur_src_row)) {
+        // First step. Nothing of the last connection is left, so this is
+        // where checkpoints are taken.
+        if (checkpoint_file != NULL && time(NULL) - last_checkpoint >= checkpoint_interval) {
+            checkpoint_write(checkpoint_file);
+            last_checkpoint = time(NULL);
+        }
+        if (multi_target) {
+            find_targets();
+        }
+        if (engine == ENGINE_BITBOARD) {
+            bitboard_start();
+        }
+        if (tree_seeding) {
+            // Every cell already in the net is a source for the next sink.
+            // Seed them in scan order so ties between equal labels are
+            // broken the same way whatever order they were laid down in.
+            NET *net = &nets[cur_wire_num];
+            qsort(net->cells, net->num_cells, sizeof(CELL_ID), compare_scan_order);
+            int num_seeds = net->num_cells;
+            for (int i = 0; i < net->num_cells; i++) {
+                seed_expansion(cell_col(net->cells[i]), cell_row(net->cells[i]));
+            }
+            printf("Labeled %d cells of net %d as first step!\n", num_seeds, cur_wire_num);
+        } else {
+            seed_expansion(cur_src_col, cur_src_row);
+            printf("Labeled source (%d, %d) as first step!\n", cur_src_col, cur_src_row);
+        }
+        if (engine == ENGINE_BIDIRECTIONAL && multi_target) {
+            for (int i = 0; i < num_targets; i++) {
+                set_sink_value(cell_col(targets[i]), cell_row(targets[i]), 1);
+                ring_buffer_push(&sink_queue, targets[i]);
+            }
+        } else if (engine == ENGINE_BIDIRECTIONAL && cur_sink_col != -1 && cur_sink_row != -1) {
+            set_sink_value(cur_sink_col, cur_sink_row, 1);
+            ring_buffer_push(&sink_queue, cell_id(cur_sink_col, cur_sink_row));
+        }
         cur_state = EXPANSION;
         return;
-    } else if (expansion_list != NULL && !sink_found) {
+    } else if (expansion_list_size() > 0 && !sink_found && engine == ENGINE_BFS) {
+        expand_bfs_step();
+    } else if (expansion_list_size() > 0 && !sink_found && engine == ENGINE_BITBOARD) {
+        expand_bitboard_step();
+    } else if (expansion_list_size() > 0 && !sink_found && engine == ENGINE_BIDIRECTIONAL) {
+        expand_bidirectional_step();
+    } else if (expansion_list_size() > 0 && !sink_found && engine == ENGINE_ASTAR) {
+        expand_astar_step();
+    } else if (expansion_list_size() > 0 && !sink_found) {
         int col, row;
         // Find the cell in the expansion list with the smallest value
         LOCATION *g = find_smallest_value();
         if (g != NULL) {
+            num_expanded_cells++;
+
+            // The key of g is its label
+            int value = expansion_list.min_key + 1;
+
             // Check to see if g is the sink. If so, then we're done
-            if (g->col == cur_sink_col && g->row == cur_sink_row) {
+            if (reached_sink(g->col, g->row)) {
                 sink_found = true;
+                sink_label = value - 1;
                 printf("Found the sink (%d, %d)\n", g->col, g->row);
-                free(g);
                 return;
             }
 
-            LOCATION *neighbors = find_all_neighbors(g->col, g->row, false, cur_wire_num);
+            LOCATION_LIST neighbors = find_all_neighbors(g->col, g->row, false, cur_wire_num);
             LOCATION *cur = NULL;
             while ((cur = pop_from_list(&neighbors)) != NULL) {
                 col = cur->col;
                 row = cur->row;
                 // if neighbor is unlabelled
-                if (grid[col][row].value == -1) {
+                if (!is_labelled(col, row)) {
                     // label it with the label of g + 1
-                    grid[col][row].value = grid[g->col][g->row].value + 1;
+                    set_label(col, row, value);
+                    set_pred(col, row, direction_between(col, row, g->col, g->row));
 
                     // Check to see if we have expanded to sink. If so, then we're done
-                    if (col == cur_sink_col && row == cur_sink_row) {
+                    if (reached_sink(col, row)) {
                         sink_found = true;
+                        sink_label = value;
                         printf("Found the sink (%d, %d)\n", g->col, g->row);
-                        free(g);
                         return;
                     }
 
                     // add neighbor to expansion list
-                    add_to_list(&expansion_list, cur);
+                    bucket_queue_push(&expansion_list, cur, value);
                 }
             }
-
-            // Don't need the LOCATION anymore. Cleanup
-            free(g);
         } else {
             printf("ERROR: cannot find smallest value...\n");
             return;
         }
     } else if (sink_found == false) {
         // Loop has terminated (i.e. couldn't hit a sink), then fail
-        printf("WARNING: Failed to route src (%d, %d) on net %d\n", cur_src_col, cur_src_row, grid[cur_src_col][cur_src_row].wire_num);
+        printf("WARNING: Failed to route src (%d, %d) on net %d\n", cur_src_col, cur_src_row, get_wire_num(cell_id(cur_src_col, cur_src_row)));
         printf("Number of retries: %d\n", num_retries);
-        if (num_retries < MAX_NUM_RETRIES) {
+        if (tree_seeding) {
+            // The whole net was already a source, so retrying can't help.
+            // Give up on this sink and move on to the next one.
+            if (multi_target) {
+                // None of the remaining sinks could be reached
+                printf("ERROR: Cannot reach any of the %d remaining sinks from net %d\n", num_targets, cur_wire_num);
+                for (int i = 0; i < num_targets; i++) {
+                    set_flag(targets[i], CELL_ROUTED);
+                    num_failed_sinks++;
+                }
+            } else {
+                printf("ERROR: Cannot reach sink (%d, %d) from net %d\n", cur_sink_col, cur_sink_row, cur_wire_num);
+                num_failed_sinks++;
+                if (cur_sink_col != -1 && cur_sink_row != -1) {
+                    set_flag(cell_id(cur_sink_col, cur_sink_row), CELL_ROUTED);
+                }
+            }
+            reset_grid();
+            sink_found = false;
+            clear_expansion_list();
+            cur_state = IDLE;
+            cur_trace_col = -1;
+            cur_trace_row = -1;
+
+            if (find_new_sink(cur_src_col, cur_src_row)) {
+                multiple_sink = true;
+            } else {
+                reset_current();
+            }
+        } else if (num_retries < MAX_NUM_RETRIES) {
             if (multiple_sink) {
                 printf("multiple sink\n");
                 // Try another "source"
@@ -880,8 +3523,9 @@ void run_lee_moore_algo() {
                 cur_trace_row = -1;
                 num_retries++;
 
-                LOCATION *failed = make_location(cur_src_col, cur_src_row);
+                LOCATION *failed = make_location(&failed_arena, cur_src_col, cur_src_row);
                 add_to_list(&failed_sources_for_multisink, failed);
+                set_flag(cell_id(cur_src_col, cur_src_row), CELL_FAILED_SOURCE);
 
                 // Need to find a new cur_src_col and new cur_src_row to route to the new sink
                 find_new_source_for_sink(cur_sink_col, cur_sink_row);
@@ -907,7 +3551,9 @@ void run_lee_moore_algo() {
         return;
     } else {
         // Traceback
-        printf("Traceback of source (%d, %d) on net %d\n", cur_src_col, cur_src_row, grid[cur_src_col][cur_src_row].wire_num);
+#ifdef DEBUG
+        printf("Traceback of source (%d, %d) on net %d\n", cur_src_col, cur_src_row, get_wire_num(cell_id(cur_src_col, cur_src_row)));
+#endif
 
         cur_state = TRACEBACK;
 
@@ -915,15 +3561,21 @@ void run_lee_moore_algo() {
         if (cur_trace_col == -1 || cur_trace_row == -1) {
             cur_trace_col = cur_sink_col;
             cur_trace_row = cur_sink_row;
+            cur_trace_value = sink_label;
+            cur_trace_dir = -1;
 
-            grid[cur_trace_col][cur_trace_row].is_wire = true;
-            grid[cur_trace_col][cur_trace_row].is_routed = true;
+            lay_wire(cur_trace_col, cur_trace_row);
+            set_flag(cell_id(cur_trace_col, cur_trace_row), CELL_ROUTED);
+            trace_path_len = 0;
+            trace_path_add(cur_trace_col, cur_trace_row);
             return;
         }
 
-        if (cur_trace_col == cur_src_col && cur_trace_row == cur_src_row) {
-            printf("Successfully finished traceback of (%d, %d) on net %d\n", cur_src_col, cur_src_row, grid[cur_src_col][cur_src_row].wire_num);
-            grid[cur_trace_col][cur_trace_row].is_wire = true;
+        // Only the sources of the wave are labelled 1
+        if (cur_trace_value == 1) {
+            printf("Successfully finished traceback of (%d, %d) on net %d\n", cur_src_col, cur_src_row, get_wire_num(cell_id(cur_src_col, cur_src_row)));
+            lay_wire(cur_trace_col, cur_trace_row);
+            solution_write_path();
 
             num_successful_sinks++;
 
@@ -934,18 +3586,26 @@ void run_lee_moore_algo() {
                 printf("There is more work to be done! Found new sink for this source\n");
                 reset_grid();
                 sink_found = false;
-                clear_expansion_list();
-                clear_failed_list();
+                clear_connection();
                 cur_state = IDLE;
                 cur_trace_col = -1;
                 cur_trace_row = -1;
 
-                // Need to find a new cur_src_col and new cur_src_row to route to the new sink
-                find_new_source_for_sink(cur_sink_col, cur_sink_row);
+                if (!tree_seeding) {
+                    // Need to find a new cur_src_col and new cur_src_row to route to the new sink
+                    find_new_source_for_sink(cur_sink_col, cur_sink_row);
+                }
             } else {
                 printf("We are done! Finished routing all sinks for source (%d, %d)\n", cur_src_col, cur_src_row);
                 printf("Number of sources: %d; Number of sinks: %d; Number of successful sinks: %d Number of failed sinks: %d\n",
                     num_sources, num_sinks, num_successful_sinks, num_failed_sinks);
+                printf("Number of expanded cells: %lld\n", num_expanded_cells);
+                printf("Number of locations allocated: %ld in %d arena blocks\n",
+                    location_arena.num_allocs + failed_arena.num_allocs + source_arena.num_allocs,
+                    location_arena.num_blocks + failed_arena.num_blocks + source_arena.num_blocks);
+                if (layout == LAYOUT_SPARSE) {
+                    printf("Number of allocated grid chunks: %d of %d\n", num_allocated_chunks, num_chunks);
+                }
                 // We are done, reset counters and states
                 reset_grid();
                 reset_current();
@@ -953,22 +3613,39 @@ void run_lee_moore_algo() {
             return;
         }
 
-        int cur_value = grid[cur_trace_col][cur_trace_row].value;
-
-        LOCATION *neighbors = find_all_neighbors(cur_trace_col, cur_trace_row, true, cur_wire_num);
-        LOCATION *cur = NULL;
         int col = -1;
         int row = -1;
 
-        while ((cur = pop_from_list(&neighbors)) != NULL) {
-            col = cur->col;
-            row = cur->row;
+        if (trace_mode != TRACE_SEARCH) {
+            // Follow the predecessor stored during expansion. The bitboard
+            // engine stores none, but finds one in the layer before.
+            int d = (engine == ENGINE_BITBOARD) ?
+                bitboard_pred(cur_trace_col, cur_trace_row, cur_trace_value) : get_pred(cur_trace_col, cur_trace_row);
+            if (trace_mode == TRACE_STRAIGHT && cur_trace_dir != -1) {
+                // Any neighbor labelled one less is on a shortest path too
+                int c = cur_trace_col + dir_col[cur_trace_dir];
+                int r = cur_trace_row + dir_row[cur_trace_dir];
+                if (is_valid_neighbor(c, r, true, cur_wire_num) && has_label(c, r, cur_trace_value - 1)) {
+                    d = cur_trace_dir;
+                }
+            }
+            cur_trace_dir = d;
+            col = cur_trace_col + dir_col[d];
+            row = cur_trace_row + dir_row[d];
+        } else {
+            LOCATION_LIST neighbors = find_all_neighbors(cur_trace_col, cur_trace_row, true, cur_wire_num);
+            LOCATION *cur = NULL;
+
+            while ((cur = pop_from_list(&neighbors)) != NULL) {
+                col = cur->col;
+                row = cur->row;
 
-            if (grid[col][row].value == cur_value - 1) {
+                if (has_label(col, row, cur_trace_value - 1)) {
 #ifdef DEBUG
-                printf("Found next cell to wire: (%d, %d)\n", col, row);
+                    printf("Found next cell to wire: (%d, %d)\n", col, row);
 #endif
-                break;
+                    break;
+                }
             }
         }
 
@@ -978,29 +3655,32 @@ void run_lee_moore_algo() {
             return;
         }
 
-        grid[col][row].is_wire = true;
-        grid[col][row].wire_num = grid[cur_src_col][cur_src_row].wire_num;
+        lay_wire(col, row);
+        set_wire_num(cell_id(col, row), get_wire_num(cell_id(cur_src_col, cur_src_row)));
+        trace_path_add(col, row);
         cur_trace_col = col;
         cur_trace_row = row;
+        cur_trace_value--;
+#ifdef DEBUG
         printf("Current trace (%d, %d)\n", cur_trace_col, cur_trace_row);
+#endif
     }
 }
 
-LOCATION *pop_from_list(LOCATION **head) {
-    LOCATION *tmp = NULL;
-    LOCATION *g = NULL;
+LOCATION *pop_from_list(LOCATION_LIST *list) {
+    LOCATION *g = list->head;
 
-    if (*head != NULL) {
-        tmp = (*head)->next;
-        if (tmp != NULL) {
-            tmp->prev = NULL;
+    if (g != NULL) {
+        list->head = g->next;
+        if (list->head != NULL) {
+            list->head->prev = NULL;
+        } else {
+            list->tail = NULL;
         }
+        list->size--;
 
-        g = *head;
         g->next = NULL;
         g->prev = NULL;
-
-        *head = tmp;
     }
 #ifdef DEBUG
     if (g != NULL) {
@@ -1013,24 +3693,20 @@ LOCATION *pop_from_list(LOCATION **head) {
     return g;
 }
 
-void add_to_list(LOCATION **head, LOCATION * g) {
-    LOCATION *cur = *head;
-
+void add_to_list(LOCATION_LIST *list, LOCATION *g) {
+#ifdef DEBUG
     printf("Adding (%d, %d) to list\n", g->col, g->row);
+#endif
 
-    if (*head == NULL) {
-        *head = g;
-        return;
-    }
-
-    // Go to the end of the list
-    while (cur->next != NULL) {
-        cur = cur->next;
-    }
-
-    cur->next = g;
-    g->prev = cur;
     g->next = NULL;
+    g->prev = list->tail;
+    if (list->tail != NULL) {
+        list->tail->next = g;
+    } else {
+        list->head = g;
+    }
+    list->tail = g;
+    list->size++;
 }
 
 void mouse_move(float x, float y) {
@@ -3884,10 +3884,10 @@ int findfontsize(float ymax) {
 
 void event_loop (void (*act_on_button) (float x, float y, int flags),
 				 void (*act_on_mousemove) (float x, float y),
-				 void (*act_on_keypress) (char c),
+				 void (*act_on_keypress) (int i),
                  void (*drawscreen) (void)) { }
 
-void init_graphics (char *window_name) { }
+void init_graphics (char *window_name, int cindex, void (*cleanup)(void)) { }
 void close_graphics (void) { }
 void update_message (char *msg) { }
 void draw_message (void) { }
@@ -3930,7 +3930,14 @@ void setOKtoPaint(int val) { }
 void setWaitForProceed(int val) { }
 
 /* William added */
-void report_structure(t_report*) { }
+/* No window, so report a fixed 1000 x 1000 drawing area. */
+void report_structure(t_report *report) {
+	report->xmult = report->ymult = 1.;
+	report->ps_xmult = report->ps_ymult = 1.;
+	report->xleft = report->ytop = 0.;
+	report->xright = report->ybot = 1000.;
+	report->top_width = report->top_height = 1000;
+}
 
 void get_mouse(int) { }
 
@@ -3965,9 +3972,9 @@ void object_start(int all) { }
 
 void object_end() { }
 
-int pt_on_object(float x, float y) { }
+int pt_on_object(int all, float x, float y) { return 0; }
 
-int findfontsize(float ymax) { }
+int findfontsize(float ymax) { return 0; }
 
 #endif
 
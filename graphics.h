@@ -3,7 +3,7 @@
 
 #ifdef WIN32
 	#include "windows.h"
-#else
+#elif !defined(NO_GRAPHICS)
 	#ifndef X11
 	#define X11
 	#endif
@@ -43,7 +43,7 @@ typedef struct {
 typedef struct {
 #ifdef X11
 	Window mainwnd; 
-#else
+#elif defined(WIN32)
 	HWND mainwnd;
 #endif
 	float xmult, ymult;